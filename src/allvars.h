@@ -18,6 +18,7 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <iomanip>
 #include <fstream>
@@ -160,6 +161,24 @@ using namespace NBody;
 #define FOFBARYONPHASETENSOR 1
 //@}
 
+/// \defgroup FOFENGINES Engines used to run the 3D FOF search of the full particle set
+//@{
+///kd-tree FOF, using OpenMP regions stitched together if enabled
+#define FOFENGINETREE 0
+///concurrent union-find over a single shared kd-tree
+#define FOFENGINEUNIONFIND 1
+///uniform grid of linking length sized cells, suited to uniform cosmological volumes
+#define FOFENGINEGRID 2
+//@}
+
+/// \defgroup FOFSUBENGINES Engines used to run the substructure, background and core FOF searches
+//@{
+///kd-tree FOF with the link criterion called through a function pointer
+#define FOFSUBENGINETREE 0
+///concurrent union-find over the kd-tree with the link criterion compiled into the search loop
+#define FOFSUBENGINEUNIONFIND 1
+//@}
+
 /// \defgroup INTERATIVESEARCHPARAMS for iterative subsubstructure search
 //@{
 /// this is minimum particle number size for a subsearch to proceed whereby substructure split up into CELLSPLITNUM new cells
@@ -229,7 +248,6 @@ using namespace NBody;
 #define CALCLOGSTDMASSWEIGHT 18
 #define CALCQUANTITYAPERTURETOTAL -1
 #define CALCQUANTITYAPERTUREAVERAGE -2
-typedef void (*ExtraPropFunc)(double, double, double&);
 
 //@}
 
@@ -281,6 +299,23 @@ typedef void (*ExtraPropFunc)(double, double, double&);
 
 //@}
 
+/// \defgroup PROPKERNELS Groups of bulk properties calculated by \ref GetProperties, combined as a bit mask
+//@{
+///rotational support about the angular momentum axis
+#define PROPKERNELROTATION 1
+///quantities within the radius of maximum circular velocity
+#define PROPKERNELRVMAX 2
+///spatial morphology
+#define PROPKERNELMORPHOLOGY 4
+///gas, star, black hole and extra dark matter properties
+#define PROPKERNELPARTTYPES 8
+#define PROPKERNELALL 15
+///value stored in properties that are skipped for an object, either because the group is disabled or the object is too small
+#define PROPUNSETVALUE (-1)
+///value stored in skipped properties that can be negative, such as angular momenta and eigenvectors, where -1 is a valid measurement
+#define PROPUNSETSIGNEDVALUE NAN
+//@}
+
 /// \defgroup PROPLIMS Particle limits for calculating properties
 //@{
 #define PROPNFWMINNUM 100
@@ -296,6 +331,10 @@ typedef void (*ExtraPropFunc)(double, double, double&);
 #define NFWMAXRHALFRATIO 0.60668
 #define NFWMINRHALFRATIO 0.05
 #define NFWMINVMAXVVIRRATIO 36.0
+/// number of concentrations at which the NFW relations are tabulated and the maximum number of Newton steps used
+/// to refine the concentration interpolated from these tables
+#define NFWCONCENTRATIONTABLESIZE 4096
+#define NFWCONCENTRATIONNEWTONMAXITER 5
 //@}
 
 
@@ -445,6 +484,16 @@ struct Options
     int iextendedoutput = 0;
     /// output extra fields in halo properties
     int iextrahalooutput = 0;
+    ///bit mask of the groups of properties calculated, see \ref PROPKERNELS
+    int ipropertykernels = PROPKERNELALL;
+    ///minimum number of particles an object must have for the more expensive properties to be calculated.
+    ///Smaller objects skip these and keep the default (unset) values in the output
+    //@{
+    Int_t apertureminsize = 0;
+    Int_t rvmaxminsize = 0;
+    Int_t morphologyminsize = 0;
+    Int_t extrapropminsize = 0;
+    //@}
     /// calculate and output extra gas fields
     int iextragasoutput = 0;
     /// calculate and output extra star fields
@@ -480,6 +529,10 @@ struct Options
     int iopenmpfof = 1;
     /// size of openmp FOF region
     int openmpfofsize = ompfofsearchnum;
+    /// engine used for 3D FOF search of the full particle set, see \ref FOFENGINES
+    int fofengine = FOFENGINETREE;
+    /// engine used for the FOF searches of substructure, background and cores, see \ref FOFSUBENGINES
+    int fofsubengine = FOFSUBENGINETREE;
 
     ///\name length,m,v,grav conversion units
     //@{
@@ -607,6 +660,8 @@ struct Options
     ///\name parameters related to 3DFOF search & subsequent 6DFOF search
     //@{
     Double_t ellhalo3dxfac = -1.0;
+    ///additional 3D linking lengths (same units as \ref ellhalo3dxfac) at which nested FOF groups are also found, sorted in decreasing order
+    vector<Double_t> ellhalo3dmultixfac;
     Double_t ellhalo6dxfac = 1;
     Double_t ellhalo6dvfac = 1.25;
     int iKeepFOF = 0;
@@ -1043,6 +1098,31 @@ struct Options
     bool inputcontainslittleh = true;
 };
 
+/*! Per object state of a (sub)structure search, kept separate from the configuration stored in \ref Options
+    so that concurrent searches of different objects can share a single set of options.
+    It is set for each object by \ref PreCalcSearchSubSet and used by \ref SearchSubset.
+*/
+struct SearchContext
+{
+    ///maximum number of particles in the grid cells used to estimate the background
+    Int_t Ncell;
+    ///velocity dispersion of the object, mean local dispersion of its grid cells and largest dispersion scale found
+    Double_t HaloSigmaV, HaloLocalSigmaV, HaloVelDispScale;
+    SearchContext(Options &opt){
+        Ncell=opt.Ncell;
+        HaloSigmaV=opt.HaloSigmaV;
+        HaloLocalSigmaV=opt.HaloLocalSigmaV;
+        HaloVelDispScale=opt.HaloVelDispScale;
+    }
+    ///store the state in the options, used when a search is run without its own context
+    void Update(Options &opt){
+        opt.Ncell=Ncell;
+        opt.HaloSigmaV=HaloSigmaV;
+        opt.HaloLocalSigmaV=HaloLocalSigmaV;
+        opt.HaloVelDispScale=HaloVelDispScale;
+    }
+};
+
 struct ConfigInfo{
     //list the name of the info
     vector<string> nameinfo;
@@ -1841,8 +1921,12 @@ struct PropData
         n_dm = 0;
 #endif
     }
+    PropData(const PropData &p) = default;
+    ///property data holds many vectors, so moving rather than copying entries makes reordering cheap
+    PropData(PropData &&p) = default;
     ///equals operator, useful if want inclusive information before substructure search
     PropData& operator=(const PropData &p) = default;
+    PropData& operator=(PropData &&p) = default;
     /*
     PropData& operator=(const PropData &p) {
         num=p.num;
@@ -2812,6 +2896,67 @@ struct StrucLevelData
     }
 };
 
+/*! Structure holding the extra gas, star, black hole and dark matter properties detached from particles.
+    The substructure search only needs the phase-space, mass and density information of particles, so these are
+    detached once before the hierarchy is searched, making the many particle copies made during the search light
+    (see \ref DetachExtraProperties and \ref ReattachExtraProperties).
+*/
+struct ExtraPropertiesStash
+{
+#ifdef GASON
+    vector<Int_t> hydroindex;
+    vector<HydroProperties*> hydro;
+#endif
+#ifdef STARON
+    vector<Int_t> starindex;
+    vector<StarProperties*> star;
+#endif
+#ifdef BHON
+    vector<Int_t> bhindex;
+    vector<BHProperties*> bh;
+#endif
+#ifdef EXTRADMON
+    vector<Int_t> extradmindex;
+    vector<ExtraDMProperties*> extradm;
+#endif
+};
+
+/*! Structure storing the result of the substructure search of a single (sub)structure.
+    These form a tree, with the substructures that are large enough to be searched in turn stored as children,
+    so that searches can be run as tasks in any order and the group ids assigned afterwards one level at a time
+    (see \ref SearchSubSub).
+*/
+struct SubSearchNode
+{
+    ///level in the hierarchy being searched, number of particles and their index in the particle array searched
+    Int_t sublevel, numingroup;
+    Int_t *pglist;
+    ///number of substructures and cores found
+    Int_t ngroup, numcores;
+    ///size and particle index lists of the substructures found, indexed from 1 to ngroup
+    Int_t *subnumingroup, **subpglist;
+    ///velocity dispersion scale of the object
+    Double_t HaloVelDispScale;
+    ///substructures to be searched for subsubstructure, in order of their group id
+    vector<SubSearchNode*> children;
+    SubSearchNode(Int_t level, Int_t num, Int_t *list){
+        sublevel=level;
+        numingroup=num;
+        pglist=list;
+        ngroup=numcores=0;
+        subnumingroup=NULL;
+        subpglist=NULL;
+        HaloVelDispScale=0;
+    }
+    ~SubSearchNode(){
+        if (ngroup>0) {
+            for (Int_t j=1;j<=ngroup;j++) delete[] subpglist[j];
+            delete[] subnumingroup;
+            delete[] subpglist;
+        }
+    }
+};
+
 #if defined(USEHDF)||defined(USEADIOS)
 ///store the names of datasets in catalog output
 struct DataGroupNames {
@@ -16,10 +16,11 @@
     The binary kd-tree decomposition using anything other than a tree in configuration space constructed
     using the shannon entropy criteron is allowed but is not \e \b advised.
     Building a physical tree with shannon entropy ensures that regions have uniform M(R)/r or more specifically uniform inter particle spacing
+    The maximum number of particles in a cell is taken from the search context if provided, otherwise from the options.
     \todo need to alter pglist array. Much smoother if use particles themselves to find nearest cells
     Instead of storing pglist which is memory intensive (nbodies*ncells) just calculate it when needed.
 */
-KDTree* InitializeTreeGrid(Options &opt, const Int_t nbodies, Particle *Part){
+KDTree* InitializeTreeGrid(Options &opt, const Int_t nbodies, Particle *Part, SearchContext *psearch){
     //First rotate into eigenvector frame.
 #ifdef SCALING
     Double_t q=1,s=1;
@@ -51,7 +52,8 @@ private(i,vel) if (nbodies > ompsubsearchnum)
     KDTree *tree;
     int itreetype = tree->TPHYS, ikerntype = tree->KEPAN, isplittingcriterion = 0, ianiso = 0 , iscale = 0;
     bool runomp = (nbodies > ompsubsearchnum);
-    LOG(trace) << "Grid system using leaf nodes with maximum size of " << opt.Ncell;
+    Int_t ncell = (psearch != NULL) ? psearch->Ncell : opt.Ncell;
+    LOG(trace) << "Grid system using leaf nodes with maximum size of " << ncell;
     if (opt.gridtype==PHYSGRID) {
         LOG(trace) << "Building Physical Tree using simple spatial extend as splitting criterion";
         //tree=new KDTree(Part,nbodies,opt.Ncell,tree->TPHYS);
@@ -71,7 +73,7 @@ private(i,vel) if (nbodies > ompsubsearchnum)
         //if phase tree, use entropy criterion with anisotropic kernel
         //tree=new KDTree(Part,nbodies,opt.Ncell,tree->TPHS,tree->KEPAN,100,1,1);
     }
-    tree=new KDTree(Part,nbodies,opt.Ncell,itreetype,ikerntype,100,isplittingcriterion,ianiso,iscale,NULL,NULL,runomp);
+    tree=new KDTree(Part,nbodies,ncell,itreetype,ikerntype,100,isplittingcriterion,ianiso,iscale,NULL,NULL,runomp);
     return tree;
 }
 
@@ -80,8 +82,6 @@ void FillTreeGrid(Options &opt, const Int_t nbodies, const Int_t ngrid, KDTree *
 //void FillTreeGrid(Options &opt, const Int_t nbodies, const Int_t ngrid, KDTree *tree, Particle *Part, GridCell* grid, PartCellNum *pglist)
 {
     Int_t gridcount=0,ncount=0;
-    //this is used to create tree and search for near neighbours
-    Particle *ptemp=new Particle[ngrid];
     int treetype=tree->GetTreeType();
     int ND;
     if (treetype==tree->TPHYS) ND=3;
@@ -128,15 +128,12 @@ void FillTreeGrid(Options &opt, const Int_t nbodies, const Int_t ngrid, KDTree *
             mtot+=Part[k].GetMass();
         }
         grid[gridcount].mass=mtot;
-        ptemp[gridcount].SetMass(mtot);
         mtot=1.0/mtot;
         for (int j=0;j<ND;j++) grid[gridcount].xm[j]=grid[gridcount].xm[j]*mtot;
-        for (int j=0;j<ND;j++) ptemp[gridcount].SetPhase(j,grid[gridcount].xm[j]);
         gridcount++; ncount=end;
     }
     //resets particle order
     delete tree;
-    delete[] ptemp;
     LOG(trace) << "Done";
 }
 
@@ -134,6 +134,74 @@ Int_tree_t *BuildGroupTailArray(const Int_t nbodies, const Int_t numgroups, Int_
     }
     return GTail;
 }
+///stable counting sort of particle indices by a dense integer key in [0,nkeys).
+///On return noffset[k] (size nkeys+1) is the start of key k in the sorted order and noffset[nkeys]=nbodies.
+///If sortindex is not NULL, it is filled with the index of the particle at each sorted position so
+///that the particles of key k are sortindex[noffset[k]..noffset[k+1]-1] in their original relative order.
+///If Part is not NULL, the key of index i is key[Part[i].GetID()], otherwise it is key[i].
+///Both output arrays are supplied by the caller so they can be reused for later group lookups.
+void BuildCountingSort(const Int_t nbodies, const Int_t nkeys, Int_t *key, Int_t *noffset, Int_t *sortindex, Particle *Part)
+{
+    int nchunks=1;
+#ifdef USEOPENMP
+    //per thread histograms only pay off if they are small compared to the number of particles
+    if (nbodies>ompsortsize) nchunks=omp_get_max_threads();
+    if ((Int_t)nchunks*nkeys>nbodies) nchunks=1;
+#endif
+    vector<Int_t> counts((size_t)nchunks*nkeys,0);
+
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(static) if (nchunks>1)
+#endif
+    for (int c=0;c<nchunks;c++) {
+        Int_t *count=&counts[(size_t)c*nkeys];
+        Int_t istart=nbodies/nchunks*c, iend=(c==nchunks-1)?nbodies:nbodies/nchunks*(c+1);
+        if (Part!=NULL) for (Int_t i=istart;i<iend;i++) count[key[Part[i].GetID()]]++;
+        else for (Int_t i=istart;i<iend;i++) count[key[i]]++;
+    }
+    //exclusive scan ordered by key then chunk keeps the sort stable
+    Int_t offset=0, n;
+    for (Int_t k=0;k<nkeys;k++) {
+        noffset[k]=offset;
+        for (int c=0;c<nchunks;c++) {
+            n=counts[(size_t)c*nkeys+k];
+            counts[(size_t)c*nkeys+k]=offset;
+            offset+=n;
+        }
+    }
+    noffset[nkeys]=offset;
+    if (sortindex==NULL) return;
+
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(static) if (nchunks>1)
+#endif
+    for (int c=0;c<nchunks;c++) {
+        Int_t *count=&counts[(size_t)c*nkeys];
+        Int_t istart=nbodies/nchunks*c, iend=(c==nchunks-1)?nbodies:nbodies/nchunks*(c+1);
+        if (Part!=NULL) for (Int_t i=istart;i<iend;i++) sortindex[count[key[Part[i].GetID()]]++]=i;
+        else for (Int_t i=istart;i<iend;i++) sortindex[count[key[i]]++]=i;
+    }
+}
+///build the group particle index list in compressed form (assumes particles are in ID order). The particles of group i are
+///pglist[noffset[i]] to pglist[noffset[i+1]-1] in increasing index order, as in \ref BuildPGList, so the group size is
+///noffset[i+1]-noffset[i]. Particles not in groups (or not of the given type if Part is provided) are listed under group 0.
+///A single index array filled by a parallel counting sort replaces the per group allocations of \ref BuildPGList
+Int_t *BuildPGListCSR(const Int_t nbodies, const Int_t numgroups, Int_t *pfof, Int_t *&pglist, Particle *Part, int type)
+{
+    Int_t *noffset=new Int_t[numgroups+2];
+    Int_t *key=pfof;
+    pglist=new Int_t[nbodies];
+    if (Part!=NULL) {
+        key=new Int_t[nbodies];
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(static) if (nbodies>ompsortsize)
+#endif
+        for (Int_t i=0;i<nbodies;i++) key[i]=(Part[i].GetType()==type)?pfof[i]:0;
+    }
+    BuildCountingSort(nbodies, numgroups+1, key, noffset, pglist);
+    if (key!=pfof) delete[] key;
+    return noffset;
+}
 ///build the group particle arrays need for unbinding procedure
 Particle **BuildPartList(Int_t numgroups, Int_t *numingroup, Int_t **pglist, Particle* Part,
     bool ikeepextrainfo)
@@ -191,24 +259,196 @@ Particle *BuildPart(Int_t numingroup, Int_t *pglist, Particle* Part,
     return gPart;
 }
 
+///detach extra properties, taking ownership of them by releasing the particle's pointer. Copies of the particles
+///then only carry the information needed for searches rather than deep copies of these properties
+void DetachExtraProperties(const Int_t nbodies, Particle *Part, ExtraPropertiesStash &stash)
+{
+    for (Int_t i=0;i<nbodies;i++) {
+#ifdef GASON
+        if (Part[i].HasHydroProperties()) {
+            stash.hydroindex.push_back(i);
+            stash.hydro.push_back(&Part[i].GetHydroProperties());
+            Part[i].NullHydroProperties();
+        }
+#endif
+#ifdef STARON
+        if (Part[i].HasStarProperties()) {
+            stash.starindex.push_back(i);
+            stash.star.push_back(&Part[i].GetStarProperties());
+            Part[i].NullStarProperties();
+        }
+#endif
+#ifdef BHON
+        if (Part[i].HasBHProperties()) {
+            stash.bhindex.push_back(i);
+            stash.bh.push_back(&Part[i].GetBHProperties());
+            Part[i].NullBHProperties();
+        }
+#endif
+#ifdef EXTRADMON
+        if (Part[i].HasExtraDMProperties()) {
+            stash.extradmindex.push_back(i);
+            stash.extradm.push_back(&Part[i].GetExtraDMProperties());
+            Part[i].NullExtraDMProperties();
+        }
+#endif
+    }
+}
+
+///return extra properties to the particles they were detached from and free the stash
+void ReattachExtraProperties(Particle *Part, ExtraPropertiesStash &stash)
+{
+#ifdef GASON
+    for (size_t i=0;i<stash.hydro.size();i++) {
+        Part[stash.hydroindex[i]].SetHydroProperties(*stash.hydro[i]);
+        delete stash.hydro[i];
+    }
+    stash.hydroindex.clear();
+    stash.hydro.clear();
+#endif
+#ifdef STARON
+    for (size_t i=0;i<stash.star.size();i++) {
+        Part[stash.starindex[i]].SetStarProperties(*stash.star[i]);
+        delete stash.star[i];
+    }
+    stash.starindex.clear();
+    stash.star.clear();
+#endif
+#ifdef BHON
+    for (size_t i=0;i<stash.bh.size();i++) {
+        Part[stash.bhindex[i]].SetBHProperties(*stash.bh[i]);
+        delete stash.bh[i];
+    }
+    stash.bhindex.clear();
+    stash.bh.clear();
+#endif
+#ifdef EXTRADMON
+    for (size_t i=0;i<stash.extradm.size();i++) {
+        Part[stash.extradmindex[i]].SetExtraDMProperties(*stash.extradm[i]);
+        delete stash.extradm[i];
+    }
+    stash.extradmindex.clear();
+    stash.extradm.clear();
+#endif
+}
+
 ///sort particles according to some quantity which is stored in particle type and build an array for a sorted particle list
 ///remember this reorders the particle array!
 Int_t *BuildNoffset(const Int_t nbodies, Particle *Part, Int_t numgroups,Int_t *numingroup, Int_t *sortval, Int_t ioffset) {
     Int_t *noffset=new Int_t[numgroups+1];
-    Int_t *storetype=new Int_t[nbodies];
+    //sort values are dense group ids so a counting sort replaces the comparison sort on the particles.
+    //Particles not in groups (or with ids beyond numgroups) share the last key and go to the back.
+    Int_t *key=new Int_t[nbodies];
+    Int_t *sortindex=new Int_t[nbodies];
+    Int_t *keyoffset=new Int_t[numgroups+3];
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(static) if (nbodies>ompsortsize)
+#endif
+    for (Int_t i=0;i<nbodies;i++) {
+        key[i]=(sortval[i]>ioffset && sortval[i]<=numgroups)?sortval[i]:numgroups+1;
+    }
+    BuildCountingSort(nbodies, numgroups+2, key, keyoffset, sortindex, Part);
+    delete[] keyoffset;
+    //invert the sorted order to get the destination of each particle and permute in place
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(static) if (nbodies>ompsortsize)
+#endif
+    for (Int_t i=0;i<nbodies;i++) key[sortindex[i]]=i;
+    delete[] sortindex;
     for (Int_t i=0;i<nbodies;i++) {
-        storetype[Part[i].GetID()]=Part[i].GetType();
-        if (sortval[Part[i].GetID()]>ioffset) Part[i].SetType(sortval[Part[i].GetID()]);
-        else Part[i].SetType(nbodies+1);//here move all particles not in groups to the back of the particle array
+        while (key[i]!=i) {
+            Int_t j=key[i];
+            swap(Part[i],Part[j]);
+            swap(key[i],key[j]);
+        }
     }
-    qsort(Part, nbodies, sizeof(Particle), TypeCompare);
+    delete[] key;
     if (numgroups >= 1) noffset[0]=noffset[1]=0;
     for (Int_t i=2;i<=numgroups;i++) noffset[i]=noffset[i-1]+numingroup[i-1];
-    for (Int_t i=0;i<nbodies;i++) Part[i].SetType(storetype[Part[i].GetID()]);
-    delete[] storetype;
     return noffset;
 }
 
+///sort particles by their distance from the origin, so positions must already be relative to the reference position.
+///The squared radii are calculated once and sorted with the particle indices, using a radix sort on the bit pattern of
+///the (non-negative) keys for large sets, parallelised if not called from within a parallel region. The particles
+///are then permuted in place, so each particle is moved once rather than swapped at every comparison.
+void SortParticlesByRadius(const Int_t n, Particle *Part)
+{
+    if (n<2) return;
+    vector<Int_t> index(n);
+    if (n<omppropnum) {
+        vector<pair<Double_t,Int_t>> rad(n);
+        for (Int_t i=0;i<n;i++) rad[i]=make_pair(Part[i].Radius2(),i);
+        sort(rad.begin(),rad.end());
+        for (Int_t i=0;i<n;i++) index[i]=rad[i].second;
+    }
+    else {
+        int nchunks=1;
+#ifdef USEOPENMP
+        if (!omp_in_parallel()) nchunks=omp_get_max_threads();
+#endif
+        const int nbits=8, ndigits=1<<nbits;
+        vector<unsigned long long> key(n), keytemp(n);
+        vector<Int_t> indextemp(n), counts((size_t)nchunks*ndigits);
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(static) if (nchunks>1)
+#endif
+        for (Int_t i=0;i<n;i++) {
+            Double_t r2=Part[i].Radius2();
+            memcpy(&key[i],&r2,sizeof(Double_t));
+            index[i]=i;
+        }
+        for (int shift=0;shift<64;shift+=nbits) {
+            fill(counts.begin(),counts.end(),0);
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(static) if (nchunks>1)
+#endif
+            for (int c=0;c<nchunks;c++) {
+                Int_t *count=&counts[(size_t)c*ndigits];
+                Int_t istart=n/nchunks*c, iend=(c==nchunks-1)?n:n/nchunks*(c+1);
+                for (Int_t i=istart;i<iend;i++) count[(key[i]>>shift)&(ndigits-1)]++;
+            }
+            //exclusive scan ordered by digit then chunk keeps each pass stable, skipping digits shared by all keys
+            Int_t offset=0, m, ndigit;
+            bool iskip=false;
+            for (int d=0;d<ndigits;d++) {
+                ndigit=offset;
+                for (int c=0;c<nchunks;c++) {
+                    m=counts[(size_t)c*ndigits+d];
+                    counts[(size_t)c*ndigits+d]=offset;
+                    offset+=m;
+                }
+                if (offset-ndigit==n) iskip=true;
+            }
+            if (iskip) continue;
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(static) if (nchunks>1)
+#endif
+            for (int c=0;c<nchunks;c++) {
+                Int_t *count=&counts[(size_t)c*ndigits];
+                Int_t istart=n/nchunks*c, iend=(c==nchunks-1)?n:n/nchunks*(c+1);
+                for (Int_t i=istart;i<iend;i++) {
+                    Int_t j=count[(key[i]>>shift)&(ndigits-1)]++;
+                    keytemp[j]=key[i];
+                    indextemp[j]=index[i];
+                }
+            }
+            key.swap(keytemp);
+            index.swap(indextemp);
+        }
+    }
+    //invert the sorted order to get the destination of each particle and permute in place
+    vector<Int_t> dest(n);
+    for (Int_t i=0;i<n;i++) dest[index[i]]=i;
+    for (Int_t i=0;i<n;i++) {
+        while (dest[i]!=i) {
+            Int_t j=dest[i];
+            swap(Part[i],Part[j]);
+            swap(dest[i],dest[j]);
+        }
+    }
+}
+
 ///reorder groups from largest to smallest
 ///\todo must alter so that after pfof is reorderd, so is numingroup array and pglist so that do not have to reconstruct this list
 ///after reordering if numgroups==newnumgroups (ie, list has not shrunk)
@@ -235,6 +475,26 @@ void ReorderGroupIDs(const Int_t numgroups, const Int_t newnumgroups, Int_t *num
     delete pq;
 }
 
+///reorder groups from largest to smallest using a compressed group particle list. Groups are ranked as in \ref ReorderGroupIDs
+///and as each group's particles are contiguous, the new ids are written in parallel
+void ReorderGroupIDs(const Int_t numgroups, const Int_t newnumgroups, Int_t *noffset, Int_t *pfof, Int_t *pglist)
+{
+    PriorityQueue *pq=new PriorityQueue(newnumgroups);
+    Int_t *groupids=new Int_t[newnumgroups+1];
+    for (Int_t i = 1; i <=numgroups; i++) if (noffset[i+1]>noffset[i]) pq->Push(i, noffset[i+1]-noffset[i]);
+    for (Int_t i = 1; i<=newnumgroups; i++) {
+        groupids[i]=pq->TopQueue();pq->Pop();
+    }
+    delete pq;
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(dynamic,ompfoflinkchunk) if (noffset[numgroups+1]-noffset[1]>ompsortsize)
+#endif
+    for (Int_t i = 1; i<=newnumgroups; i++) {
+        for (Int_t j=noffset[groupids[i]];j<noffset[groupids[i]+1];j++) pfof[pglist[j]]=i;
+    }
+    delete[] groupids;
+}
+
 ///similar to \ref ReorderGroupIDs but weight by value
 void ReorderGroupIDsbyValue(const Int_t numgroups, const Int_t newnumgroups, Int_t *numingroup, Int_t *pfof, Int_t **pglist, Int_t *value)
 {
@@ -310,20 +570,47 @@ void ReorderGroupIDsAndArraybyValue(const Int_t numgroups, const Int_t newnumgro
     delete pq;
     delete[] gtemp;
 }
+///reorder property data in place so that pdata[i] holds the old pdata[order[i]] for i=1..newnumgroups. Groups not
+///listed in order are moved past newnumgroups. Entries are moved along the cycles of the permutation, so the property
+///array is never duplicated. The order array must have numgroups+1 entries and is overwritten.
+void ReorderPropData(const Int_t numgroups, const Int_t newnumgroups, Int_t *order, PropData *pdata)
+{
+    vector<bool> done(numgroups+1,false);
+    Int_t j, k;
+    //complete the permutation with the groups that have been dropped
+    for (Int_t i = 1; i <= newnumgroups; i++) done[order[i]]=true;
+    j=newnumgroups+1;
+    for (Int_t i = 1; i <= numgroups; i++) if (!done[i]) order[j++]=i;
+    for (Int_t i = 1; i <= numgroups; i++) done[i]=false;
+    for (Int_t i = 1; i <= numgroups; i++) {
+        if (done[i]) continue;
+        done[i]=true;
+        if (order[i]==i) continue;
+        PropData ptemp=std::move(pdata[i]);
+        j=i;
+        while (order[j]!=i) {
+            k=order[j];
+            pdata[j]=std::move(pdata[k]);
+            done[k]=true;
+            j=k;
+        }
+        pdata[j]=std::move(ptemp);
+    }
+}
 ///similar to \ref ReorderGroupIDsbyValue but also reorder associated property data
 void ReorderGroupIDsAndHaloDatabyValue(const Int_t numgroups, const Int_t newnumgroups, Int_t *numingroup, Int_t *pfof, Int_t **pglist, Int_t *value, PropData *pdata)
 {
     PriorityQueue *pq=new PriorityQueue(newnumgroups);
-    PropData *ptemp=new PropData[numgroups+1];
+    Int_t *order=new Int_t[numgroups+1];
     Int_t groupid;
-    for (Int_t i = 1; i <= numgroups; i++) ptemp[i]=pdata[i];
     for (Int_t i = 1; i <= numgroups; i++) if (numingroup[i]>0) pq->Push(i, value[i]);
     for (Int_t i = 1; i <= newnumgroups; i++) {
         groupid=pq->TopQueue();pq->Pop();
         for (Int_t j=0;j<numingroup[groupid];j++) pfof[pglist[groupid][j]]=i;
-        pdata[i]=ptemp[groupid];
+        order[i]=groupid;
     }
     delete pq;
-    delete[] ptemp;
+    ReorderPropData(numgroups, newnumgroups, order, pdata);
+    delete[] order;
 }
 //@}
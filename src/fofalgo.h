@@ -41,6 +41,108 @@ int FOFPositivetypes(Particle &a, Particle &b, Double_t *params);
 int FOF3dDM(Particle &a, Particle &b, Double_t *params);
 //@}
 
+/*! \name FOF criteria as policy classes
+    These apply the same tests as the functions above, in the same arithmetic form so that pairs on the linking boundary
+    are treated identically, but copy the parameters they need on construction and are inlined into templated search
+    loops (see \ref FOFCriterionUnionFind), so that the criterion is selected once per search instead of being called
+    through a \ref FOFcompfunc pointer for every pair. All criteria only link particles within the physical linking
+    length, whose square is stored in ball2 and used to search the tree.
+    Criteria that are not symmetric in the two particles are tested from both ends of a pair.
+*/
+//@{
+///3D physical linking, see \ref FOF3d
+struct FOF3dLink {
+    static const bool symmetric = true;
+    Double_t ball2;
+    FOF3dLink(Double_t *params) : ball2(params[6]) {}
+    inline int operator()(Particle &a, Particle &b) const {
+        Double_t total=0;
+        for (int j=0;j<3;j++) total+=(a.GetPosition(j)-b.GetPosition(j))*(a.GetPosition(j)-b.GetPosition(j))/ball2;
+        return (total<1);
+    }
+};
+///3D physical linking where the primary particle must be of a given type, see \ref FOF3dDM
+struct FOF3dDMLink {
+    static const bool symmetric = false;
+    Double_t ball2;
+    int type;
+    FOF3dDMLink(Double_t *params) : ball2(params[6]), type(int(params[7])) {}
+    inline int operator()(Particle &a, Particle &b) const {
+        if (a.GetType()!=type) return 0;
+        Double_t total=0;
+        for (int j=0;j<3;j++) total+=(a.GetPosition(j)-b.GetPosition(j))*(a.GetPosition(j)-b.GetPosition(j))/ball2;
+        return (total<1);
+    }
+};
+///6D phase-space linking, see \ref FOF6d
+struct FOF6dLink {
+    static const bool symmetric = true;
+    Double_t ball2, vell2;
+    FOF6dLink(Double_t *params) : ball2(params[6]), vell2(params[7]) {}
+    inline int operator()(Particle &a, Particle &b) const {
+        Double_t total=0;
+        for (int j=0;j<3;j++){
+            total+=(a.GetPosition(j)-b.GetPosition(j))*(a.GetPosition(j)-b.GetPosition(j))/ball2;
+            total+=(a.GetVelocity(j)-b.GetVelocity(j))*(a.GetVelocity(j)-b.GetVelocity(j))/vell2;
+        }
+        return (total<1);
+    }
+};
+///6D phase-space linking of particles below a potential (ell) threshold, see \ref FOF6dbg
+struct FOF6dbgLink {
+    static const bool symmetric = true;
+    FOF6dLink link6d;
+    Double_t threshold;
+    Double_t ball2;
+    FOF6dbgLink(Double_t *params) : link6d(params), threshold(params[9]), ball2(params[6]) {}
+    inline int operator()(Particle &a, Particle &b) const {
+        if (a.GetPotential()>=threshold||b.GetPotential()>=threshold) return 0;
+        return link6d(a,b);
+    }
+};
+///6D phase-space linking of particles above a potential (ell) threshold, see \ref FOF6dbgup
+struct FOF6dbgupLink {
+    static const bool symmetric = true;
+    FOF6dLink link6d;
+    Double_t threshold;
+    Double_t ball2;
+    FOF6dbgupLink(Double_t *params) : link6d(params), threshold(params[9]), ball2(params[6]) {}
+    inline int operator()(Particle &a, Particle &b) const {
+        if (a.GetPotential()<threshold||b.GetPotential()<threshold) return 0;
+        return link6d(a,b);
+    }
+};
+///stream linking of outlier particles, see \ref FOFStreamwithprob
+struct FOFStreamwithprobLink {
+    static const bool symmetric = true;
+    Double_t ball2, vratio, costheta, threshold;
+    FOFStreamwithprobLink(Double_t *params) : ball2(params[6]), vratio(params[7]), costheta(params[8]), threshold(params[9]) {}
+    inline int operator()(Particle &a, Particle &b) const {
+        if (a.GetPotential()<threshold||b.GetPotential()<threshold) return 0;
+        Double_t total=0,v1=0,v2=0,vdot=0,vnorm;
+        for (int j=0;j<3;j++){
+            total+=(a.GetPosition(j)-b.GetPosition(j))*(a.GetPosition(j)-b.GetPosition(j))/ball2;
+            v1+=a.GetVelocity(j)*a.GetVelocity(j);
+            v2+=b.GetVelocity(j)*b.GetVelocity(j);
+            vdot+=a.GetVelocity(j)*b.GetVelocity(j);
+        }
+        v1=sqrt(v1);v2=sqrt(v2);
+        vnorm=1.0/(v1*v2);
+        vdot*=vnorm;
+        return (total<1.0&&vdot>costheta&&v1/v2<vratio&&v1/v2>1.0/vratio);
+    }
+};
+///fall back for criteria without a policy class, calling the comparison function through its pointer
+struct FOFcompfuncLink {
+    static const bool symmetric = false;
+    FOFcompfunc cmp;
+    Double_t *params;
+    Double_t ball2;
+    FOFcompfuncLink(FOFcompfunc c, Double_t *p) : cmp(c), params(p), ball2(p[6]) {}
+    inline int operator()(Particle &a, Particle &b) const {return cmp(a,b,params);}
+};
+//@}
+
 /// \name FOF precheck algorithms
 //@{
 ///checks to see if particle should be ingored based on potential being above threshold value stored in param 9
@@ -0,0 +1,724 @@
+/*! \file fofengine.cxx
+ *  \brief this file contains alternative engines used to run the 3D FOF search of the full particle set.
+
+    The default engine is the kd-tree FOF provided by NBodylib (optionally split into OpenMP regions that are
+    then stitched together, see \ref omproutines.cxx). The engines here produce the same groups but differ in
+    how links are found and how groups are constructed from these links. When only some particles can generate
+    links (the dark matter basis of the separate baryon search), the groups of basis particles are the same and each
+    other particle is attached to a single group, that of the basis particle of smallest index within the linking
+    length, rather than to whichever group happens to reach it first in the tree search.
+ */
+
+#include <atomic>
+
+#include "logging.h"
+#include "stf.h"
+#include "timer.h"
+
+/// \name Concurrent disjoint-set used by the union-find FOF engine
+//@{
+
+/*!
+    Returns the root of the set containing element i, splitting the path as it is traversed
+    (every element visited is pointed to its grandparent).
+    Roots are only ever linked to roots of smaller index, so parent values are monotonically decreasing
+    and relaxed atomics suffice to keep the structure acyclic while other threads link concurrently.
+*/
+static inline Int_t UnionFindRoot(std::atomic<Int_t> *parent, Int_t i)
+{
+    Int_t p, gp;
+    while (true) {
+        p = parent[i].load(std::memory_order_relaxed);
+        if (p == i) return i;
+        gp = parent[p].load(std::memory_order_relaxed);
+        if (p == gp) return p;
+        parent[i].compare_exchange_weak(p, gp, std::memory_order_relaxed);
+        i = p;
+    }
+}
+
+///Merge the sets containing i and j by linking the root of larger index to that of smaller index using compare-and-swap
+static inline void UnionFindLink(std::atomic<Int_t> *parent, Int_t i, Int_t j)
+{
+    Int_t expected;
+    while (true) {
+        i = UnionFindRoot(parent, i);
+        j = UnionFindRoot(parent, j);
+        if (i == j) return;
+        if (i < j) swap(i, j);
+        expected = i;
+        if (parent[i].compare_exchange_strong(expected, j, std::memory_order_relaxed)) return;
+    }
+}
+
+/*!
+    Attach element j, which does not generate links, to element i. If several elements are attached to j, the one
+    of smallest index is kept (attach values start at -1), so the result does not depend on the order of the calls.
+*/
+static inline void UnionFindAttach(std::atomic<Int_t> *attach, Int_t j, Int_t i)
+{
+    Int_t current = attach[j].load(std::memory_order_relaxed);
+    while ((current < 0 || i < current) && !attach[j].compare_exchange_weak(current, i, std::memory_order_relaxed));
+}
+
+///Set the root of every attached element to that of the element it is attached to (root must already be flattened)
+static void UnionFindAttachRoots(const Int_t nbodies, std::atomic<Int_t> *attach, Int_t *root)
+{
+    Int_t i, index;
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) private(i, index) schedule(static) if (nbodies > ompfofsearchnum)
+#endif
+    for (i=0;i<nbodies;i++) {
+        index = attach[i].load(std::memory_order_relaxed);
+        if (index >= 0) root[i] = root[index];
+    }
+}
+//@}
+
+/// \name Tree ball search visiting each neighbour
+//@{
+
+///Distance from x to the interval [xlow,xup], using the nearest periodic image of x if period>0
+static inline Double_t FOFBallIntervalDist(Double_t x, Double_t xlow, Double_t xup, Double_t period)
+{
+    Double_t d = (x < xlow) ? xlow-x : ((x > xup) ? x-xup : 0);
+    if (period > 0 && d > 0) {
+        d = min(d, (x+period < xlow) ? xlow-x-period : ((x+period > xup) ? x+period-xup : 0));
+        d = min(d, (x-period < xlow) ? xlow-x+period : ((x-period > xup) ? x-period-xup : 0));
+    }
+    return d;
+}
+
+/*!
+    Call visit with the index of every particle of the tree (in the tree order, as returned by
+    \ref KDTree::SearchBallPosTagged) within sqrt(r2) of x. The nodes are walked directly so, unlike the buffer filling
+    ball search, no per thread array able to hold every particle is needed. If period is not NULL, distances are
+    measured to the nearest periodic image.
+*/
+template<class Visit> static void FOFBallVisit(Node *np, Particle *Part, const Coordinate &x, const Double_t r2,
+    const Double_t *period, Visit &visit)
+{
+    Double_t d, dist2 = 0;
+    for (auto k=0;k<3;k++) {
+        d = FOFBallIntervalDist(x[k], np->GetBoundary(k,0), np->GetBoundary(k,1), (period != NULL) ? period[k] : 0);
+        dist2 += d*d;
+        if (dist2 > r2) return;
+    }
+    SplitNode *split = dynamic_cast<SplitNode*>(np);
+    if (split != NULL) {
+        FOFBallVisit(split->GetLeft(), Part, x, r2, period, visit);
+        FOFBallVisit(split->GetRight(), Part, x, r2, period, visit);
+        return;
+    }
+    for (Int_t j=np->GetStart();j<np->GetEnd();j++) {
+        dist2 = 0;
+        for (auto k=0;k<3;k++) {
+            d = Part[j].GetPosition(k)-x[k];
+            if (period != NULL) {
+                if (d > 0.5*period[k]) d -= period[k];
+                else if (d < -0.5*period[k]) d += period[k];
+            }
+            dist2 += d*d;
+        }
+        if (dist2 < r2) visit(j);
+    }
+}
+//@}
+
+/// \name Union-find 3D FOF
+//@{
+
+/*!
+    Build group ids from the set roots of every particle. Groups with fewer than minsize members are removed and
+    the remainder are ordered by decreasing size (ties broken by root index so the result is deterministic).
+    The returned pfof array is indexed by the particle id, like that returned by KDTree::FOF. If Head and Next are
+    provided, these are filled in the current particle order so they can be used by the MPI linking routines.
+*/
+Int_t *FOFRootsToGroupIDs(const Int_t nbodies, Particle *Part, Int_t *root, const Int_t minsize, Int_t &numgroups,
+    Int_tree_t *Head, Int_tree_t *Next)
+{
+    Int_t *pfof = new Int_t[nbodies];
+    Int_t *numinroot = new Int_t[nbodies];
+    Int_t *rootgid;
+    vector<Int_t> grouproots;
+    Int_t i;
+
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) private(i) schedule(static) if (nbodies > ompfofsearchnum)
+#endif
+    for (i=0;i<nbodies;i++) numinroot[i] = 0;
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) private(i) schedule(static) if (nbodies > ompfofsearchnum)
+#endif
+    for (i=0;i<nbodies;i++) {
+#ifdef USEOPENMP
+#pragma omp atomic
+#endif
+        numinroot[root[i]]++;
+    }
+    for (i=0;i<nbodies;i++) if (root[i] == i && numinroot[i] >= minsize) grouproots.push_back(i);
+    sort(grouproots.begin(), grouproots.end(), [&numinroot](const Int_t &a, const Int_t &b) {
+        if (numinroot[a] != numinroot[b]) return numinroot[a] > numinroot[b];
+        return a < b;
+    });
+    numgroups = grouproots.size();
+    //reuse the size array to store the group id of each root
+    rootgid = numinroot;
+    for (i=0;i<nbodies;i++) if (root[i] == i) rootgid[i] = 0;
+    for (i=0;i<numgroups;i++) rootgid[grouproots[i]] = i+1;
+    grouproots.clear();
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) private(i) schedule(static) if (nbodies > ompfofsearchnum)
+#endif
+    for (i=0;i<nbodies;i++) pfof[Part[i].GetID()] = rootgid[root[i]];
+
+    if (Head != NULL && Next != NULL) {
+        Int_t *tail = new Int_t[numgroups+1], gid;
+        Int_t *gidofpart = root;
+        for (i=0;i<nbodies;i++) gidofpart[i] = pfof[Part[i].GetID()];
+        for (i=0;i<=numgroups;i++) tail[i] = -1;
+        for (i=0;i<nbodies;i++) {
+            Next[i] = -1;
+            gid = gidofpart[i];
+            if (gid == 0 || tail[gid] == -1) Head[i] = i;
+            else {
+                Head[i] = Head[tail[gid]];
+                Next[tail[gid]] = i;
+            }
+            if (gid > 0) tail[gid] = i;
+        }
+        delete[] tail;
+    }
+    delete[] numinroot;
+    return pfof;
+}
+
+/*!
+    3D FOF search of the full particle set using a concurrent disjoint-set over a single shared tree.
+    Every particle searches the tree for neighbours within the linking length and links directly to them,
+    so unlike the OpenMP region search, there is no import or stitching phase.
+    If fofcheck is provided, only particles passing this check generate links (ie: the dark matter basis
+    used in the separate baryon search). Pairs of basis particles are linked and every other particle found by
+    a basis particle is attached to a single group (see \ref UnionFindAttach), so it never joins two groups.
+    Otherwise each pair is linked once.
+    The tree must have been built on Part (with \ref KDTree::OverWriteInputOrder called), the square of the
+    linking length is stored in param[1] and period is NULL unless the volume is periodic.
+*/
+Int_t *FOFUnionFind(const Int_t nbodies, vector<Particle> &Part, KDTree *&tree, Double_t *param, Double_t *period,
+    const Int_t minsize, Int_t &numgroups, FOFcheckfunc fofcheck, Int_tree_t *Head, Int_tree_t *Next)
+{
+    std::atomic<Int_t> *parent = new std::atomic<Int_t>[nbodies];
+    std::atomic<Int_t> *attach = NULL;
+    char *plinks = NULL;
+    Int_t *root, *pfof;
+    Int_t i;
+    bool iusecheck = (fofcheck != NULL);
+
+    LOG(info) << "Linking particles with union-find FOF";
+    vr::Timer t;
+    if (iusecheck) {
+        attach = new std::atomic<Int_t>[nbodies];
+        plinks = new char[nbodies];
+    }
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) private(i) schedule(static) if (nbodies > ompfofsearchnum)
+#endif
+    for (i=0;i<nbodies;i++) {
+        parent[i].store(i, std::memory_order_relaxed);
+        if (iusecheck) {
+            attach[i].store(-1, std::memory_order_relaxed);
+            plinks[i] = (fofcheck(Part[i], param) == 0);
+        }
+    }
+
+#ifdef USEOPENMP
+#pragma omp parallel default(shared) \
+private(i)
+{
+#endif
+    Coordinate x;
+#ifdef USEOPENMP
+    #pragma omp for schedule(dynamic, ompfoflinkchunk) nowait
+#endif
+    for (i=0;i<nbodies;i++) {
+        if (iusecheck && !plinks[i]) continue;
+        for (auto k=0;k<3;k++) x[k] = Part[i].GetPosition(k);
+        auto link = [&](Int_t j) {
+            if (j == i) return;
+            if (iusecheck && !plinks[j]) UnionFindAttach(attach, j, i);
+            //pairs are found from both ends so only link once
+            else if (j > i) UnionFindLink(parent, i, j);
+        };
+        FOFBallVisit(tree->GetRoot(), Part.data(), x, param[1], period, link);
+    }
+#ifdef USEOPENMP
+}
+#endif
+    LOG(debug) << "Finished union-find linking in " << t;
+
+    //flatten the sets so each particle points directly to its root
+    root = new Int_t[nbodies];
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) private(i) schedule(static) if (nbodies > ompfofsearchnum)
+#endif
+    for (i=0;i<nbodies;i++) root[i] = UnionFindRoot(parent, i);
+    delete[] parent;
+    if (iusecheck) {
+        UnionFindAttachRoots(nbodies, attach, root);
+        delete[] attach;
+        delete[] plinks;
+    }
+
+    pfof = FOFRootsToGroupIDs(nbodies, Part.data(), root, minsize, numgroups, Head, Next);
+    delete[] root;
+    LOG(info) << "Finished union-find FOF with " << numgroups << " groups in " << t;
+    return pfof;
+}
+//@}
+
+/// \name Union-find FOF with compile-time link criteria
+//@{
+
+/*!
+    Link all pairs of particles meeting the criterion using the concurrent disjoint-set. The criterion is a policy
+    class (see \ref fofalgo.h) so the pair test is inlined. Particles for which check returns a non-zero value are
+    ignored, as in \ref KDTree::FOFCriterion.
+*/
+template<class FOFLink> static void FOFLinkPairsUnionFind(const Int_t nbodies, Particle *Part, KDTree *tree,
+    const FOFLink &link, FOFcheckfunc check, Double_t *param, std::atomic<Int_t> *parent)
+{
+    Int_t i;
+#ifdef USEOPENMP
+#pragma omp parallel default(shared) \
+private(i) if (nbodies > ompsearchnum)
+{
+#endif
+    Coordinate x;
+#ifdef USEOPENMP
+    #pragma omp for schedule(dynamic, ompfoflinkchunk) nowait
+#endif
+    for (i=0;i<nbodies;i++) {
+        if (check != NULL && check(Part[i], param) != 0) continue;
+        for (auto k=0;k<3;k++) x[k] = Part[i].GetPosition(k);
+        auto visit = [&](Int_t j) {
+            if (j == i || (FOFLink::symmetric && j < i)) return;
+            if (check != NULL && check(Part[j], param) != 0) return;
+            if (link(Part[i], Part[j])) UnionFindLink(parent, i, j);
+        };
+        FOFBallVisit(tree->GetRoot(), Part, x, link.ball2, NULL, visit);
+    }
+#ifdef USEOPENMP
+}
+#endif
+}
+
+/*!
+    FOF search using an arbitrary link criterion, producing the same groups as \ref KDTree::FOFCriterion with ordering
+    by group size. The comparison function is mapped to its policy class once here, so the templated search loop
+    avoids a function pointer call per pair. Criteria without a policy class fall back to calling fofcmp.
+    The tree must have been built on Part without periodic boundaries, as for the substructure searches, and the returned
+    pfof is indexed by particle id.
+*/
+Int_t *FOFCriterionUnionFind(const Int_t nbodies, Particle *Part, KDTree *tree, FOFcompfunc fofcmp, Double_t *param,
+    const Int_t minsize, Int_t &numgroups, FOFcheckfunc check)
+{
+    std::atomic<Int_t> *parent = new std::atomic<Int_t>[nbodies];
+    Int_t *root, *pfof;
+    Int_t i;
+
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) private(i) schedule(static) if (nbodies > ompfofsearchnum)
+#endif
+    for (i=0;i<nbodies;i++) parent[i].store(i, std::memory_order_relaxed);
+    if (fofcmp == &FOFStreamwithprob) FOFLinkPairsUnionFind(nbodies, Part, tree, FOFStreamwithprobLink(param), check, param, parent);
+    else if (fofcmp == &FOF6d) FOFLinkPairsUnionFind(nbodies, Part, tree, FOF6dLink(param), check, param, parent);
+    else if (fofcmp == &FOF6dbg) FOFLinkPairsUnionFind(nbodies, Part, tree, FOF6dbgLink(param), check, param, parent);
+    else if (fofcmp == &FOF6dbgup) FOFLinkPairsUnionFind(nbodies, Part, tree, FOF6dbgupLink(param), check, param, parent);
+    else if (fofcmp == &FOF3d) FOFLinkPairsUnionFind(nbodies, Part, tree, FOF3dLink(param), check, param, parent);
+    else if (fofcmp == &FOF3dDM) FOFLinkPairsUnionFind(nbodies, Part, tree, FOF3dDMLink(param), check, param, parent);
+    else FOFLinkPairsUnionFind(nbodies, Part, tree, FOFcompfuncLink(fofcmp, param), check, param, parent);
+
+    root = new Int_t[nbodies];
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) private(i) schedule(static) if (nbodies > ompfofsearchnum)
+#endif
+    for (i=0;i<nbodies;i++) root[i] = UnionFindRoot(parent, i);
+    delete[] parent;
+    pfof = FOFRootsToGroupIDs(nbodies, Part, root, minsize, numgroups);
+    delete[] root;
+    return pfof;
+}
+//@}
+
+/// \name Cell-grid 3D FOF
+//@{
+
+///maximum number of cells per dimension, set by the 21 bits per dimension available in a 64 bit Morton key
+#define FOFGRIDMAXCELLDIM 2097152
+
+///spread the lower 21 bits of v so that there are two zero bits between each bit
+static inline unsigned long long FOFGridSpreadBits(unsigned long long v)
+{
+    v &= 0x1fffffULL;
+    v = (v | v << 32) & 0x1f00000000ffffULL;
+    v = (v | v << 16) & 0x1f0000ff0000ffULL;
+    v = (v | v << 8) & 0x100f00f00f00f00fULL;
+    v = (v | v << 4) & 0x10c30c30c30c30c3ULL;
+    v = (v | v << 2) & 0x1249249249249249ULL;
+    return v;
+}
+
+///inverse of \ref FOFGridSpreadBits
+static inline unsigned long long FOFGridCompactBits(unsigned long long v)
+{
+    v &= 0x1249249249249249ULL;
+    v = (v ^ (v >> 2)) & 0x10c30c30c30c30c3ULL;
+    v = (v ^ (v >> 4)) & 0x100f00f00f00f00fULL;
+    v = (v ^ (v >> 8)) & 0x1f0000ff0000ffULL;
+    v = (v ^ (v >> 16)) & 0x1f00000000ffffULL;
+    v = (v ^ (v >> 32)) & 0x1fffffULL;
+    return v;
+}
+
+///Morton (z-order) key of a cell
+static inline unsigned long long FOFGridMortonKey(unsigned long long ix, unsigned long long iy, unsigned long long iz)
+{
+    return FOFGridSpreadBits(ix) | (FOFGridSpreadBits(iy) << 1) | (FOFGridSpreadBits(iz) << 2);
+}
+
+///number of key bits sorted per pass of \ref FOFGridSortKeys
+#define FOFGRIDRADIXBITS 11
+
+/*!
+    Stable LSD radix sort of the particle order by cell key, each pass being the parallel \ref BuildCountingSort
+    on FOFGRIDRADIXBITS bits of the key. Passes above the highest bit of maxkey are skipped, so a grid of up to
+    1024 cells per dimension needs 3 passes. On return pkey[order[i]] is non-decreasing in i and particles
+    within a cell are in index order, matching a sort of the (key, index) pairs.
+*/
+static void FOFGridSortKeys(const Int_t nbodies, const unsigned long long *pkey, unsigned long long maxkey, Int_t *&order)
+{
+    const Int_t nkeys = 1 << FOFGRIDRADIXBITS;
+    const unsigned long long mask = nkeys-1;
+    Int_t *digit = new Int_t[nbodies];
+    Int_t *sortindex = new Int_t[nbodies];
+    Int_t *neworder = new Int_t[nbodies];
+    Int_t *noffset = new Int_t[nkeys+1];
+    Int_t i;
+
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) private(i) schedule(static) if (nbodies > ompsortsize)
+#endif
+    for (i=0;i<nbodies;i++) order[i] = i;
+    for (auto shift=0; shift == 0 || (shift < 64 && (maxkey >> shift) > 0); shift += FOFGRIDRADIXBITS) {
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) private(i) schedule(static) if (nbodies > ompsortsize)
+#endif
+        for (i=0;i<nbodies;i++) digit[i] = (pkey[order[i]] >> shift) & mask;
+        BuildCountingSort(nbodies, nkeys, digit, noffset, sortindex);
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) private(i) schedule(static) if (nbodies > ompsortsize)
+#endif
+        for (i=0;i<nbodies;i++) neworder[i] = order[sortindex[i]];
+        swap(order, neworder);
+    }
+    delete[] digit;
+    delete[] sortindex;
+    delete[] neworder;
+    delete[] noffset;
+}
+
+/*!
+    3D FOF search of the full particle set using a uniform grid of cells whose width is at least the linking length.
+    Particles are sorted into cells in Morton order and their positions copied into contiguous (structure of arrays)
+    buffers. Each occupied cell is then only compared to itself and its (up to) 26 neighbouring cells, with the distance
+    checks of a particle against a neighbouring cell done in a single vectorisable loop. Links are recorded with the same
+    concurrent disjoint-set used by \ref FOFUnionFind, and particles that do not pass fofcheck are attached to the
+    same single group, so the groups produced are identical. This is well suited to
+    uniform cosmological volumes, where the grid is well balanced, and does not need a tree for the FOF itself.
+    Periodic boundaries use the minimum image distance with period opt.p. The square of the linking length is stored in param[1].
+*/
+Int_t *FOFGrid(Options &opt, const Int_t nbodies, vector<Particle> &Part, Double_t *param,
+    const Int_t minsize, Int_t &numgroups, FOFcheckfunc fofcheck, Int_tree_t *Head, Int_tree_t *Next)
+{
+    const Double_t ell2 = param[1], ell = sqrt(param[1]);
+    const Double_t period = opt.p, halfperiod = 0.5*opt.p;
+    const bool iperiodic = (opt.p > 0), iusecheck = (fofcheck != NULL);
+    Double_t xmin[3], xmax[3], cellsize[3];
+    long long ncelldim[3];
+    unsigned long long *pkey, maxkey;
+    Int_t *porder;
+    vector<unsigned long long> cellkey;
+    vector<Int_t> celloffset;
+    Double_t *px, *py, *pz;
+    Int_t *pindex;
+    char *plinks = NULL;
+    std::atomic<Int_t> *parent, *attach = NULL;
+    Int_t *root, *pfof;
+    Int_t i, ncells;
+
+    LOG(info) << "Linking particles with cell-grid FOF";
+    vr::Timer t;
+
+    //set the grid extent, either the periodic box or the bounding box of the particles
+    if (iperiodic) {
+        for (auto j=0;j<3;j++) {xmin[j] = 0; xmax[j] = period;}
+    }
+    else {
+        Double_t x0min, x1min, x2min, x0max, x1max, x2max;
+        x0min = x0max = Part[0].GetPosition(0);
+        x1min = x1max = Part[0].GetPosition(1);
+        x2min = x2max = Part[0].GetPosition(2);
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) private(i) schedule(static) if (nbodies > ompfofsearchnum) \
+reduction(min:x0min,x1min,x2min) reduction(max:x0max,x1max,x2max)
+#endif
+        for (i=0;i<nbodies;i++) {
+            x0min = min(x0min, Part[i].GetPosition(0)); x0max = max(x0max, Part[i].GetPosition(0));
+            x1min = min(x1min, Part[i].GetPosition(1)); x1max = max(x1max, Part[i].GetPosition(1));
+            x2min = min(x2min, Part[i].GetPosition(2)); x2max = max(x2max, Part[i].GetPosition(2));
+        }
+        xmin[0] = x0min; xmin[1] = x1min; xmin[2] = x2min;
+        xmax[0] = x0max; xmax[1] = x1max; xmax[2] = x2max;
+    }
+    for (auto j=0;j<3;j++) {
+        ncelldim[j] = (long long)floor((xmax[j]-xmin[j])/ell);
+        ncelldim[j] = max(1LL, min(ncelldim[j], (long long)FOFGRIDMAXCELLDIM));
+        cellsize[j] = (xmax[j]-xmin[j])/(Double_t)ncelldim[j];
+        if (cellsize[j] <= 0) cellsize[j] = 1.0;
+    }
+    LOG(debug) << "FOF grid of " << ncelldim[0] << "x" << ncelldim[1] << "x" << ncelldim[2] << " cells";
+
+    //sort particles into cells by Morton key
+    pkey = new unsigned long long[nbodies];
+    porder = new Int_t[nbodies];
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) private(i) schedule(static) if (nbodies > ompfofsearchnum)
+#endif
+    for (i=0;i<nbodies;i++) {
+        long long ix[3];
+        for (auto j=0;j<3;j++) {
+            ix[j] = (long long)floor((Part[i].GetPosition(j)-xmin[j])/cellsize[j]);
+            if (iperiodic) {
+                ix[j] %= ncelldim[j];
+                if (ix[j] < 0) ix[j] += ncelldim[j];
+            }
+            else ix[j] = max(0LL, min(ix[j], ncelldim[j]-1));
+        }
+        pkey[i] = FOFGridMortonKey(ix[0], ix[1], ix[2]);
+    }
+    maxkey = FOFGridMortonKey(ncelldim[0]-1, ncelldim[1]-1, ncelldim[2]-1);
+    FOFGridSortKeys(nbodies, pkey, maxkey, porder);
+
+    //copy cell contents into contiguous arrays and store the occupied cells
+    px = new Double_t[nbodies];
+    py = new Double_t[nbodies];
+    pz = new Double_t[nbodies];
+    pindex = new Int_t[nbodies];
+    if (iusecheck) plinks = new char[nbodies];
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) private(i) schedule(static) if (nbodies > ompfofsearchnum)
+#endif
+    for (i=0;i<nbodies;i++) {
+        Int_t index = porder[i];
+        px[i] = Part[index].GetPosition(0);
+        py[i] = Part[index].GetPosition(1);
+        pz[i] = Part[index].GetPosition(2);
+        pindex[i] = index;
+        if (iusecheck) plinks[i] = (fofcheck(Part[index], param) == 0);
+    }
+    for (i=0;i<nbodies;i++) {
+        if (i == 0 || pkey[porder[i]] != pkey[porder[i-1]]) {
+            cellkey.push_back(pkey[porder[i]]);
+            celloffset.push_back(i);
+        }
+    }
+    celloffset.push_back(nbodies);
+    ncells = cellkey.size();
+    delete[] pkey;
+    delete[] porder;
+
+    parent = new std::atomic<Int_t>[nbodies];
+    if (iusecheck) attach = new std::atomic<Int_t>[nbodies];
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) private(i) schedule(static) if (nbodies > ompfofsearchnum)
+#endif
+    for (i=0;i<nbodies;i++) {
+        parent[i].store(i, std::memory_order_relaxed);
+        if (iusecheck) attach[i].store(-1, std::memory_order_relaxed);
+    }
+
+    //link particles in each cell to those in the same and neighbouring cells, each pair of cells visited once
+#ifdef USEOPENMP
+#pragma omp parallel default(shared) \
+private(i)
+{
+#endif
+    vector<unsigned long long> nkeys;
+    vector<char> inlink;
+    nkeys.reserve(27);
+#ifdef USEOPENMP
+    #pragma omp for schedule(dynamic) nowait
+#endif
+    for (i=0;i<ncells;i++) {
+        long long ix[3], nx[3];
+        bool iskip;
+        ix[0] = FOFGridCompactBits(cellkey[i]);
+        ix[1] = FOFGridCompactBits(cellkey[i] >> 1);
+        ix[2] = FOFGridCompactBits(cellkey[i] >> 2);
+        nkeys.clear();
+        for (auto di=-1;di<=1;di++) for (auto dj=-1;dj<=1;dj++) for (auto dk=-1;dk<=1;dk++) {
+            nx[0] = ix[0]+di; nx[1] = ix[1]+dj; nx[2] = ix[2]+dk;
+            iskip = false;
+            for (auto j=0;j<3;j++) {
+                if (nx[j] < 0 || nx[j] >= ncelldim[j]) {
+                    if (iperiodic) nx[j] = (nx[j]+ncelldim[j])%ncelldim[j];
+                    else iskip = true;
+                }
+            }
+            if (iskip) continue;
+            unsigned long long key = FOFGridMortonKey(nx[0], nx[1], nx[2]);
+            if (key >= cellkey[i]) nkeys.push_back(key);
+        }
+        //small periodic grids can wrap onto the same cell several times
+        sort(nkeys.begin(), nkeys.end());
+        nkeys.erase(unique(nkeys.begin(), nkeys.end()), nkeys.end());
+
+        for (auto &key:nkeys) {
+            auto it = lower_bound(cellkey.begin(), cellkey.end(), key);
+            if (it == cellkey.end() || *it != key) continue;
+            Int_t ncell = it - cellkey.begin();
+            Int_t nstart = celloffset[ncell], nend = celloffset[ncell+1];
+            inlink.resize(nend-nstart);
+            for (auto k=celloffset[i];k<celloffset[i+1];k++) {
+                Int_t jstart = (ncell == i) ? k+1 : nstart;
+                const Double_t x = px[k], y = py[k], z = pz[k];
+                //distance check against all particles in neighbouring cell
+                for (auto j=jstart;j<nend;j++) {
+                    Double_t dx = x-px[j], dy = y-py[j], dz = z-pz[j];
+                    if (iperiodic) {
+                        dx = (dx > halfperiod) ? dx-period : ((dx < -halfperiod) ? dx+period : dx);
+                        dy = (dy > halfperiod) ? dy-period : ((dy < -halfperiod) ? dy+period : dy);
+                        dz = (dz > halfperiod) ? dz-period : ((dz < -halfperiod) ? dz+period : dz);
+                    }
+                    inlink[j-nstart] = (dx*dx+dy*dy+dz*dz < ell2);
+                }
+                for (auto j=jstart;j<nend;j++) {
+                    if (!inlink[j-nstart]) continue;
+                    //only dark matter (or appropriate type) particles generate links, others are attached to a single group
+                    if (!iusecheck || (plinks[k] && plinks[j])) UnionFindLink(parent, pindex[k], pindex[j]);
+                    else if (plinks[k]) UnionFindAttach(attach, pindex[j], pindex[k]);
+                    else if (plinks[j]) UnionFindAttach(attach, pindex[k], pindex[j]);
+                }
+            }
+        }
+    }
+#ifdef USEOPENMP
+}
+#endif
+    LOG(debug) << "Finished cell-grid linking of " << ncells << " occupied cells in " << t;
+    delete[] px;
+    delete[] py;
+    delete[] pz;
+    delete[] pindex;
+    if (iusecheck) delete[] plinks;
+
+    root = new Int_t[nbodies];
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) private(i) schedule(static) if (nbodies > ompfofsearchnum)
+#endif
+    for (i=0;i<nbodies;i++) root[i] = UnionFindRoot(parent, i);
+    delete[] parent;
+    if (iusecheck) {
+        UnionFindAttachRoots(nbodies, attach, root);
+        delete[] attach;
+    }
+
+    pfof = FOFRootsToGroupIDs(nbodies, Part.data(), root, minsize, numgroups, Head, Next);
+    delete[] root;
+    LOG(info) << "Finished cell-grid FOF with " << numgroups << " groups in " << t;
+    return pfof;
+}
+//@}
+
+/// \name Multiple linking length 3D FOF
+//@{
+
+/*!
+    3D FOF search at several linking lengths in a single pass over the particles. ell2 holds the squares of the linking
+    lengths in decreasing order and each level has its own disjoint-set. Every particle searches the tree once using the
+    largest linking length, visiting neighbours as they are found (see \ref FOFBallVisit), and each pair is tested once, being linked at every level whose linking length exceeds the
+    pair separation. Since a FOF group found with a shorter linking length is always contained in one found with a
+    longer linking length, the group ids at the different levels are nested.
+    The tree must have been built on Part. Returns an array of pfof arrays (one per level, indexed by particle id,
+    ordered by size as in \ref FOFRootsToGroupIDs) and stores the number of groups at each level in numgroups.
+*/
+Int_t **FOFMultiLinkingLength(Options &opt, const Int_t nbodies, vector<Particle> &Part, KDTree *&tree,
+    vector<Double_t> &ell2, const Int_t minsize, vector<Int_t> &numgroups)
+{
+    const int nlevels = ell2.size();
+    const Double_t period = opt.p, halfperiod = 0.5*opt.p;
+    const bool iperiodic = (opt.p > 0);
+    Double_t periodbox[3] = {opt.p, opt.p, opt.p};
+    std::atomic<Int_t> **parent = new std::atomic<Int_t>*[nlevels];
+    Int_t **pfof = new Int_t*[nlevels];
+    Int_t *root;
+    Int_t i;
+    Double_t dx, dy, dz, d2;
+    Coordinate x;
+
+    LOG(info) << "Linking particles at " << nlevels << " linking lengths";
+    vr::Timer t;
+    for (auto k=0;k<nlevels;k++) {
+        parent[k] = new std::atomic<Int_t>[nbodies];
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) private(i) schedule(static) if (nbodies > ompfofsearchnum)
+#endif
+        for (i=0;i<nbodies;i++) parent[k][i].store(i, std::memory_order_relaxed);
+    }
+
+#ifdef USEOPENMP
+#pragma omp parallel default(shared) \
+private(i, x, dx, dy, dz, d2)
+{
+    #pragma omp for schedule(dynamic, ompfoflinkchunk) nowait
+#endif
+    for (i=0;i<nbodies;i++) {
+        for (auto k=0;k<3;k++) x[k] = Part[i].GetPosition(k);
+        auto link = [&](Int_t j) {
+            if (j <= i) return;
+            dx = Part[i].GetPosition(0)-Part[j].GetPosition(0);
+            dy = Part[i].GetPosition(1)-Part[j].GetPosition(1);
+            dz = Part[i].GetPosition(2)-Part[j].GetPosition(2);
+            if (iperiodic) {
+                dx = (dx > halfperiod) ? dx-period : ((dx < -halfperiod) ? dx+period : dx);
+                dy = (dy > halfperiod) ? dy-period : ((dy < -halfperiod) ? dy+period : dy);
+                dz = (dz > halfperiod) ? dz-period : ((dz < -halfperiod) ? dz+period : dz);
+            }
+            d2 = dx*dx+dy*dy+dz*dz;
+            //levels are sorted by decreasing linking length so stop at the first one the pair fails
+            for (auto k=0;k<nlevels && d2<ell2[k];k++) UnionFindLink(parent[k], i, j);
+        };
+        FOFBallVisit(tree->GetRoot(), Part.data(), x, ell2[0], iperiodic ? periodbox : NULL, link);
+    }
+#ifdef USEOPENMP
+}
+#endif
+    LOG(debug) << "Finished multiple linking length union-find linking in " << t;
+
+    numgroups.resize(nlevels);
+    root = new Int_t[nbodies];
+    for (auto k=0;k<nlevels;k++) {
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) private(i) schedule(static) if (nbodies > ompfofsearchnum)
+#endif
+        for (i=0;i<nbodies;i++) root[i] = UnionFindRoot(parent[k], i);
+        delete[] parent[k];
+        pfof[k] = FOFRootsToGroupIDs(nbodies, Part.data(), root, minsize, numgroups[k]);
+        LOG(info) << "Linking length " << sqrt(ell2[k]) << " has " << numgroups[k] << " groups";
+    }
+    delete[] root;
+    delete[] parent;
+    LOG(info) << "Finished multiple linking length FOF in " << t;
+    return pfof;
+}
+//@}
@@ -321,6 +321,40 @@ void WriteFOF(Options &opt, const Int_t nbodies, Int_t *pfof){
     LOG(info) << "Done";
 }
 
+/*! Writes an ascii fof.multi.grp file of the nested group ids found at each of the additional 3D linking lengths
+    (see \ref FOFMultiLinkingLength). The first line contains the number of particles and the number of linking lengths,
+    the second the linking lengths and then each line lists the group ids of a particle at every linking length.
+    As with \ref WriteFOF, particle types not searched are listed as untagged.
+*/
+void WriteFOFMultiLinkingLength(Options &opt, const Int_t nbodies, const int nlevels, Int_t **pfoflevels){
+    fstream Fout;
+    char fname[1000];
+    Int_t nbefore=0, nafter=0;
+    if (opt.partsearchtype==PSTDARK) {nbefore=opt.numpart[GASTYPE];nafter=opt.numpart[STARTYPE];}
+    else if (opt.partsearchtype==PSTSTAR) nbefore=opt.numpart[GASTYPE]+opt.numpart[DARKTYPE];
+    else if (opt.partsearchtype==PSTGAS) nafter=opt.numpart[DARKTYPE]+opt.numpart[STARTYPE];
+    sprintf(fname,"%s.fof.multi.grp",opt.outname);
+    LOG(info) << "Saving multiple linking length fof data to " << fname;
+    Fout.open(fname,ios::out);
+    Fout<<nbefore+nbodies+nafter<<" "<<nlevels<<endl;
+    for (auto k=0;k<nlevels;k++) Fout<<opt.ellhalo3dmultixfac[k]<<" ";
+    Fout<<endl;
+    for (Int_t i=0;i<nbefore;i++) {
+        for (auto k=0;k<nlevels;k++) Fout<<0<<" ";
+        Fout<<endl;
+    }
+    for (Int_t i=0;i<nbodies;i++) {
+        for (auto k=0;k<nlevels;k++) Fout<<pfoflevels[k][i]<<" ";
+        Fout<<endl;
+    }
+    for (Int_t i=0;i<nafter;i++) {
+        for (auto k=0;k<nlevels;k++) Fout<<0<<" ";
+        Fout<<endl;
+    }
+    Fout.close();
+    LOG(info) << "Done";
+}
+
 /*! Writes a particle group list array file that contains the total number of groups,
     local number of groups (if using MPI) and group id followed by number of particles
     in that group and particle ids in the group
@@ -7,7 +7,59 @@
 #include "logging.h"
 #include "stf.h"
 
+/*! Find for each grid cell the cells that can be among the MAXNGRID+1 nearest cells of any particle in the cell.
+    A particle lies within the bounding box of the particles in its own cell, so its nearest cell centres can be no further
+    than the MAXNGRID+1 th smallest maximum distance from that box to a cell centre. All cells whose centre lies within this
+    distance of the box form the stencil of the cell. Also stores the cell each particle belongs to, with particles that are
+    not in any cell given a stencil of all cells.
+*/
+static void BuildCellStencils(const Int_t nbodies, Particle *Part, Int_t ngrid, GridCell *grid, int nnear,
+    Int_t *cellindex, vector<vector<Int_t>> &stencil)
+{
+    Int_t i;
+    stencil.resize(ngrid);
+    for (i=0;i<nbodies;i++) cellindex[i]=-1;
+#ifdef USEOPENMP
+#pragma omp parallel default(shared) \
+private(i) if (nbodies > ompsubsearchnum)
+{
+#pragma omp for schedule(dynamic)
+#endif
+    for (i=0;i<ngrid;i++) {
+        Double_t xbl[3], xbu[3], d, dmin, dmax, rmax;
+        vector<Double_t> dmin2(ngrid), dmax2(ngrid);
+        for (int k=0;k<3;k++) {xbl[k]=grid[i].xm[k];xbu[k]=grid[i].xm[k];}
+        for (Int_t j=0;j<grid[i].nparts;j++) {
+            Int_t index=grid[i].nindex[j];
+            cellindex[index]=i;
+            for (int k=0;k<3;k++) {
+                if (Part[index].GetPosition(k)<xbl[k]) xbl[k]=Part[index].GetPosition(k);
+                if (Part[index].GetPosition(k)>xbu[k]) xbu[k]=Part[index].GetPosition(k);
+            }
+        }
+        for (Int_t j=0;j<ngrid;j++) {
+            dmin=dmax=0;
+            for (int k=0;k<3;k++) {
+                d=max(xbl[k]-grid[j].xm[k],grid[j].xm[k]-xbu[k]);
+                if (d>0) dmin+=d*d;
+                d=max(abs(grid[j].xm[k]-xbl[k]),abs(grid[j].xm[k]-xbu[k]));
+                dmax+=d*d;
+            }
+            dmin2[j]=dmin;
+            dmax2[j]=dmax;
+        }
+        nth_element(dmax2.begin(),dmax2.begin()+(nnear-1),dmax2.end());
+        rmax=dmax2[nnear-1];
+        for (Int_t j=0;j<ngrid;j++) if (dmin2[j]<=rmax) stencil[i].push_back(j);
+    }
+#ifdef USEOPENMP
+}
+#endif
+}
+
 /*! This calculates the logarithmic ratio of the measured velocity density and the expected velocity density assuming a bg muiltivariate gaussian distribution
+    The background at a particle's position is interpolated from the MAXNGRID+1 nearest grid cells, which are found from a stencil
+    of candidate cells precomputed for the cell containing the particle (see \ref BuildCellStencils).
     \todo must adjust interpolation scheme so that if NN has cells in a neighbouring MPI domain, the information is stored locally. This may require a rewrite
     of the grid cell structure or the near neighbour list so that if grid cell has NN in another processor, actually physically store the information cm, cmvel, veldisp
     locally to that grid cell. Another option is to determine all cells that are NN of a cell in another mpi's domain, build a grid export list that contains the relevant information
@@ -16,7 +68,7 @@
 void GetDenVRatio(Options &opt, const Int_t nbodies, Particle *Part, Int_t ngrid, GridCell *grid, Coordinate *gvel, Matrix *gveldisp)
 {
     Int_t i;
-    int nthreads,tid;
+    int nthreads,tid,nnear;
     Double_t **dist;
     Double_t norm=pow(2.0*M_PI,-1.5);
     Int_t **nn;
@@ -24,8 +76,11 @@ void GetDenVRatio(Options &opt, const Int_t nbodies, Particle *Part, Int_t ngrid
     Double_t w,wsum,maxdist,sv,vsv,fbg,tempdenv;
     Coordinate vp,vmweighted;
     Matrix isvweighted;
-    Particle *ptemp;
-    KDTree *tree;
+    Particle *ptemp=NULL;
+    KDTree *tree=NULL;
+    Int_t *cellindex=NULL;
+    vector<vector<Int_t>> stencil;
+    vector<Int_t> allcells;
 
     LOG(trace) << "Calculating denvratios using grid";
     //take inverse for interpolation
@@ -40,8 +95,8 @@ private(i) if (nbodies > ompsubsearchnum)
 }
 #endif
 
-    //build grid tree so that one can find nearest cells for each particle
     //if using MPI since number of cells is far fewer than number of particles, simple gather collect all the data so that each processor has access to it
+    //cells then no longer correspond to local particles so build grid tree so that one can find nearest cells for each particle
 #ifdef USEMPI
     if(opt.iSingleHalo) {
     Ngridlocal=ngrid;
@@ -57,11 +112,19 @@ private(i) if (nbodies > ompsubsearchnum)
     grid=mpi_grid;
     gvel=mpi_gvel;
     gveldisp=mpi_gveldisp;
-    }
-#endif
     ptemp=new Particle[ngrid];
     for (i=0;i<ngrid;i++) ptemp[i]=Particle(1.0,grid[i].xm[0],grid[i].xm[1],grid[i].xm[2],0.0,0.0,0.0,i);
     tree=new KDTree(ptemp,ngrid,1,tree->TPHYS, tree->KEPAN,100,0,0,0,NULL,NULL,false);
+    }
+#endif
+    nnear=min((Int_t)MAXNGRID+1,ngrid);
+    //otherwise particles are in the cells so use the stencil of the cell containing the particle
+    if (tree==NULL) {
+        cellindex=new Int_t[nbodies];
+        BuildCellStencils(nbodies, Part, ngrid, grid, nnear, cellindex, stencil);
+        allcells.resize(ngrid);
+        for (i=0;i<ngrid;i++) allcells[i]=i;
+    }
 
 #ifndef USEOPENMP
     nthreads=1;
@@ -81,6 +144,9 @@ private(i) if (nbodies > ompsubsearchnum)
 private(i,w,wsum,sv,vsv,fbg,vp,maxdist,vmweighted,isvweighted,tid,tempdenv) \
 if (nbodies > ompsubsearchnum)
 {
+#endif
+    vector<pair<Double_t,Int_t>> candidates;
+#ifdef USEOPENMP
 #pragma omp for schedule(static)
 #endif
     for (i=0;i<nbodies;i++)
@@ -102,17 +168,34 @@ if (nbodies > ompsubsearchnum)
         vmweighted[0]=vmweighted[1]=vmweighted[2]=0.;
         for (int j=0;j<3;j++) for (int k=0;k<3;k++) isvweighted(j,k)=0.0;
         Coordinate xpos(Part[i].GetPosition());
-        tree->FindNearestPos(xpos,nn[tid],dist[tid],MAXNGRID+1);
-        for (int j=0;j<=MAXNGRID;j++) {
+        if (tree!=NULL) {
+            tree->FindNearestPos(xpos,nn[tid],dist[tid],nnear);
+            for (int j=0;j<nnear;j++) nn[tid][j]=ptemp[nn[tid][j]].GetID();
+        }
+        else {
+            vector<Int_t> &cells = (cellindex[i]>=0) ? stencil[cellindex[i]] : allcells;
+            candidates.resize(cells.size());
+            for (size_t j=0;j<cells.size();j++) {
+                Double_t d2=0;
+                for (int k=0;k<3;k++) d2+=(xpos[k]-grid[cells[j]].xm[k])*(xpos[k]-grid[cells[j]].xm[k]);
+                candidates[j]=make_pair(d2,cells[j]);
+            }
+            partial_sort(candidates.begin(),candidates.begin()+nnear,candidates.end());
+            for (int j=0;j<nnear;j++) {
+                dist[tid][j]=candidates[j].first;
+                nn[tid][j]=candidates[j].second;
+            }
+        }
+        for (int j=0;j<nnear;j++) {
            dist[tid][j]=sqrt(dist[tid][j]+1e-16);
            if (dist[tid][j]>maxdist)maxdist=dist[tid][j];
         }
-        for (int j=0;j<=MAXNGRID;j++) {
+        for (int j=0;j<nnear;j++) {
             w=(maxdist-dist[tid][j])/(maxdist*dist[tid][j]);w=w*w;
             //w=1.0/dist[tid][j];
             wsum+=w;
-            vmweighted=vmweighted+gvel[ptemp[nn[tid][j]].GetID()]*w;
-            isvweighted=isvweighted+gveldisp[ptemp[nn[tid][j]].GetID()]*w;
+            vmweighted=vmweighted+gvel[nn[tid][j]]*w;
+            isvweighted=isvweighted+gveldisp[nn[tid][j]]*w;
         }
         vmweighted=vmweighted*(1.0/wsum);
         isvweighted=isvweighted*(1.0/wsum);
@@ -132,8 +215,9 @@ if (nbodies > ompsubsearchnum)
     delete[] nn;
     delete[] gvel;
     delete[] gveldisp;
-    delete tree;
-    delete[] ptemp;
+    if (tree!=NULL) delete tree;
+    if (ptemp!=NULL) delete[] ptemp;
+    if (cellindex!=NULL) delete[] cellindex;
     delete[] grid;
 }
 
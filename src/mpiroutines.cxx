@@ -5246,7 +5246,7 @@ Int_t MPISearchBaryons(const Int_t nbaryons, Particle *&Pbaryons, Int_t *&pfofba
     Particle p1;
     Int_t  i, j, k, pindex,nexport=0;
     int tid;
-    FOFcompfunc fofcmp=FOF6d;
+    FOF6dLink link6d(param);
     Int_t *nnID;
     Double_t *dist2;
     if (NImport>0) {
@@ -5278,7 +5278,7 @@ private(i,j,k,tid,p1,pindex,x1,D2,dval,rval,nnID,dist2)
             D2=0;
             pindex=PartDataGet[nnID[j]].GetID();
             if (numingroup[pfofbaryons[i]]<FoFDataGet[pindex].iLen) {
-                if (fofcmp(p1,PartDataGet[nnID[j]],param)) {
+                if (link6d(p1,PartDataGet[nnID[j]])) {
                     for (k=0;k<3;k++) {
                         D2+=(p1.GetPosition(k)-PartDataGet[nnID[j]].GetPosition(k))*(p1.GetPosition(k)-PartDataGet[nnID[j]].GetPosition(k))/param[6]+(p1.GetVelocity(k)-PartDataGet[nnID[j]].GetVelocity(k))*(p1.GetVelocity(k)-PartDataGet[nnID[j]].GetVelocity(k))/param[7];
                     }
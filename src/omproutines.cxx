@@ -289,77 +289,61 @@ void OpenMPLinkAcross(Options &opt,
 
 Int_t OpenMPResortParticleandGroups(Int_t nbodies, vector<Particle> &Part, Int_t *&pfof, Int_t minsize)
 {
-#ifndef USEMPI
-    int ThisTask=0,NProcs=1;
-#endif
-    Int_t ngroups = 0, newnumgroups = 0;;
-    vector<Int_t> numingroup, index;
-    unordered_map<Int_t, Int_t> pfofoldtonew;
-    PriorityQueue *pq;
+    Int_t ngroups = 0, newnumgroups = 0;
+    Int_t *noffset;
+    vector<Int_t> index, pfofoldtonew;
 
-    //init data
+    //init data, group ids are dense so group sizes are a histogram over pfof
+    #pragma omp parallel for default(shared) schedule(static) reduction(max:ngroups) if (nbodies > ompsortsize)
     for (auto i=0;i<nbodies;i++) if (ngroups < pfof[i]) ngroups = pfof[i];
-    numingroup.resize(ngroups+1,0);
-    index.resize(ngroups+1);
-    for (auto i=0;i<=ngroups;i++) index[i] = i;
-    for (auto i=0;i<nbodies;i++) if (pfof[i]>0) numingroup[pfof[i]]++;
-    for (auto i=1;i<=ngroups;i++) {
-        if (numingroup[i]<minsize) numingroup[i] = 0;
-        else newnumgroups++;
-    }
+    noffset = new Int_t[ngroups+2];
+    BuildCountingSort(nbodies, ngroups+1, pfof, noffset, NULL);
+    index.reserve(ngroups);
+    for (auto i=1;i<=ngroups;i++) if (noffset[i+1]-noffset[i] >= minsize) index.push_back(i);
+    newnumgroups = index.size();
     //if no groups are large enough, zero and return
     if (newnumgroups == 0) {
         #pragma omp parallel for default(shared)
         for (auto i=0;i<nbodies;i++) {
             pfof[i] = 0;
         }
-        ngroups = newnumgroups;
-        return ngroups;
+        delete[] noffset;
+        return newnumgroups;
     }
 
     //otherwise, remap group ids so as to be in decreasing group size
-    //first set all pfof values for all groups below minsize to zero
-    for (auto i=0;i<nbodies;i++) {
-        if (pfof[i] == 0) continue;
-        if (numingroup[pfof[i]]<minsize) pfof[i] = 0;
-    }
-    pq = new PriorityQueue(newnumgroups);
-    for (auto i=1;i<=ngroups;i++) {
-        if (numingroup[i] == 0) continue;
-        pq->Push(index[i],numingroup[i]);
-    }
-    ngroups = newnumgroups;
-    newnumgroups = 0;
-    //generate map
-    for (auto i=0;i<ngroups;i++) {
-        pfofoldtonew[pq->TopQueue()] = ++newnumgroups;
-        pq->Pop();
-    }
-    delete pq;
+    //groups below minsize map to zero
+    sort(index.begin(), index.end(), [&noffset](const Int_t &a, const Int_t &b) {
+        Int_t na = noffset[a+1]-noffset[a], nb = noffset[b+1]-noffset[b];
+        if (na != nb) return na > nb;
+        return a < b;
+    });
+    pfofoldtonew.resize(ngroups+1, 0);
+    for (auto i=0;i<newnumgroups;i++) pfofoldtonew[index[i]] = i+1;
+    delete[] noffset;
     //set new group id values stored in pfof
-    for (auto i=0;i<nbodies;i++) {
-        if (pfof[i] == 0) continue;
-        pfof[i]=pfofoldtonew[pfof[i]];
-    }
-    return ngroups;
+    #pragma omp parallel for default(shared) schedule(static) if (nbodies > ompsortsize)
+    for (auto i=0;i<nbodies;i++) pfof[i] = pfofoldtonew[pfof[i]];
+    return newnumgroups;
 }
 
 void OpenMPHeadNextUpdate(const Int_t nbodies, vector<Particle> &Part, const Int_t numgroups, Int_t *&pfof, Int_tree_t *&Head, Int_tree_t *&Next){
-    Int_t *numingroup;
-    Int_t **pglist;
-    numingroup=BuildNumInGroup(nbodies, numgroups, pfof);
-    pglist=BuildPGList(nbodies, numgroups, numingroup, pfof, Part.data());
+    //particles of each group in current particle order, contiguous in sortindex
+    Int_t *noffset = new Int_t[numgroups+2];
+    Int_t *sortindex = new Int_t[nbodies];
+    BuildCountingSort(nbodies, numgroups+1, pfof, noffset, sortindex, Part.data());
+    #pragma omp parallel for default(shared) schedule(static) if (nbodies > ompsortsize)
     for (auto i=0;i<nbodies;i++) {
         Head[i]=i;
         Next[i]=-1;
     }
+    #pragma omp parallel for default(shared) schedule(dynamic) if (numgroups > ompsearchnum)
     for (auto i=1;i<=numgroups;i++) {
-        for (auto j=1;j<numingroup[i];j++) Head[pglist[i][j]]=pglist[i][0];
-        for (auto j=0;j<numingroup[i]-1;j++) Next[pglist[i][j]]=pglist[i][j+1];
+        for (auto j=noffset[i]+1;j<noffset[i+1];j++) Head[sortindex[j]]=sortindex[noffset[i]];
+        for (auto j=noffset[i];j<noffset[i+1]-1;j++) Next[sortindex[j]]=sortindex[j+1];
     }
-    for (auto i=1;i<=numgroups;i++) delete[] pglist[i];
-    delete[] numingroup;
-    delete[] pglist;
+    delete[] noffset;
+    delete[] sortindex;
 }
 
 //@}
@@ -33,6 +33,8 @@ using namespace NBody;
 #define omppropnum 50000
 #define ompfofsearchnum 2000000
 #define ompsortsize 1000000
+///chunk of particles handed to a thread when linking particles in the union-find FOF
+#define ompfoflinkchunk 1024
 //@}
 
 #ifdef USEOPENMP 
@@ -67,6 +67,8 @@ void WriteLocalVelocityDensity(Options &opt, const Int_t nbodies, vector<Particl
 
 ///Writes a tipsy formatted fof.grpfile
 void WriteFOF(Options &opt, const Int_t nbodies, Int_t *pfof);
+///Writes the group ids of every particle at each of the additional 3D FOF linking lengths
+void WriteFOFMultiLinkingLength(Options &opt, const Int_t nbodies, const int nlevels, Int_t **pfoflevels);
 ///Writes a pg list file (first in effective index order of input file(s), second is particle ids
 void WritePGList(Options &opt, const Int_t ngroups, const Int_t ng, Int_t *numingroup, Int_t **pglist, Int_t *ids);
 ///Write catalog information (number of groups, number in groups, number of particles in groups, particle pids)
@@ -141,7 +143,7 @@ void WriteExtendedOutput (Options &opt, Int_t numgroups, Int_t nbodies, PropData
 //@{
 
 ///Set up non-uniform grid structure using kd-tree
-KDTree* InitializeTreeGrid(Options &opt, const Int_t nbodies, Particle *Part);
+KDTree* InitializeTreeGrid(Options &opt, const Int_t nbodies, Particle *Part, SearchContext *psearch=NULL);
 ///Fill cells of grid from tree
 void FillTreeGrid(Options &opt, const Int_t nbodies, const Int_t ngrid, KDTree *&tree, Particle *Part, GridCell* &grid);
 
@@ -205,9 +207,13 @@ Int_t GetOutliersValues(Options &opt, const Int_t nbodies, Particle *Part, int s
 ///Search full system without finding outliers first
 Int_t *SearchFullSet(Options &opt, const Int_t nbodies, vector<Particle> &Part, Int_t &numgroups);
 ///Search the outliers
-Int_t *SearchSubset(Options &opt, const Int_t nbodies, const Int_t nsubset, Particle *Partsubset, Int_t &numgroups, Int_t sublevel=0, Int_t *pnumcores=NULL);
+Int_t *SearchSubset(Options &opt, const Int_t nbodies, const Int_t nsubset, Particle *Partsubset, Int_t &numgroups, Int_t sublevel=0, Int_t *pnumcores=NULL, SearchContext *psearch=NULL);
 ///Search for subsubstructures
 void SearchSubSub(Options &opt, const Int_t nsubset, vector<Particle> &Partsubset, Int_t *&pfof, Int_t &ngroup, Int_t &nhalos, PropData *pdata=NULL);
+///Search a single (sub)structure for substructure, storing the result in a node of the search tree
+void SearchSubSubNode(Options &opt, vector<Particle> &Partsubset, SubSearchNode *node);
+///Search the full hierarchy below a set of (sub)structures, running searches as tasks
+void SearchSubSubTree(Options &opt, vector<Particle> &Partsubset, vector<SubSearchNode*> &roots);
 ///Given a set of tagged core particles, assign surroundings
 void HaloCoreGrowth(Options &opt, const Int_t nsubset, Particle *&Partsubset, Int_t *&pfof, Int_t *&pfofbg, Int_t &numgroupsbg, Double_t param[], vector<Double_t> &dispfac,
     int numactiveloops, vector<int> &corelevel, int nthreads);
@@ -356,12 +362,10 @@ void CalcVelSigmaTensor(const Int_t n, Particle *p, Double_t &a, Double_t &b, Do
 void CalcPhaseSigmaTensor(const Int_t n, Particle *p, GMatrix &eigenvalues, GMatrix& eigenvec, GMatrix &I, int itype=-1);
 ///Calculate phase-space dispersion tensor
 void CalcPhaseSigmaTensor(const Int_t n, Particle *p, GMatrix &I, int itype=-1);
-///Calculate the reduced weighted inertia tensor used to determine the spatial morphology
-void CalcMTensor(Matrix& M, const Double_t q, const Double_t s, const Int_t n, Particle *p, int itype);
-///Same as \ref CalcMTensor but include mass
-void CalcMTensorWithMass(Matrix& M, const Double_t q, const Double_t s, const Int_t n, Particle *p, int itype);
-///Rotate particles to some coordinate frame
-void RotParticles(const Int_t n, Particle *p, Matrix &R);
+///Calculate the reduced weighted inertia tensor of a set of weighted coordinates
+void CalcMTensor(Matrix& M, const Double_t q, const Double_t s, const Int_t n, const Double_t *x, const Double_t *y, const Double_t *z, const Double_t *w);
+///Rotate a set of coordinates to some coordinate frame
+void RotCoordinates(const Int_t n, Double_t *x, Double_t *y, Double_t *z, Matrix &R);
 ///get phase-space center-of-mass
 GMatrix CalcPhaseCM(const Int_t n, Particle *p, int itype=-1);
 
@@ -371,22 +375,14 @@ void CalcConcentration(PropData &p);
 double CalcConcentrationRootFindingRhalf(double , double);
 //root finding using Vmax
 double CalcConcentrationRootFindingVmax(double , double);
-///wrappers for root finding used to get concentration
-double mycNFW(double c, void *params);
-///wrappers for root finding used to get concentration
-double mycNFW_deriv(double c, void *params);
-///wrappers for root finding used to get concentration
-void mycNFW_fdf(double c, void *params, double*y,double *dy);
-///wrappers for root finding used to get concentration
-double mycNFWRhalf(double c, void *params);
 ///Calculate aperture quantities
 void CalculateApertureQuantities(Options &opt, Int_t &ning, Particle *Part, PropData &pdata);
 //Calculate half-mass radii by interpolating
 Double_t GetApertureRadiusInterpolation(const Double_t &oldrc, const Double_t &rc, const Double_t &EncMass, const Double_t &mass, const Double_t refmass);
 ///determine the radial bin for calculating profiles
 int GetRadialBin(Options &opt, Double_t rc, int &ibin);
-///add a particle's properties to the appropriate radial bin.
-void AddParticleToRadialBin(Options &opt, Particle *Pval, Double_t irnorm, int &ibin, PropData &pdata);
+///add all the particles of a radially sorted group to the radial bins
+void AddParticlesToRadialBins(Options &opt, const Int_t n, Particle *Part, Double_t irnorm, PropData &pdata);
 ///add data to the appropriate radial bin
 void AddDataToRadialBin(Options &opt, Double_t rval, Double_t massval,
 #if defined(GASON) || defined(STARON) || defined(BHON)
@@ -394,12 +390,12 @@ void AddDataToRadialBin(Options &opt, Double_t rval, Double_t massval,
 #endif
     Double_t irnorm, int &ibin, PropData &pdata);
 void AddParticleToRadialBinInclusive(Options &opt, Particle *Pval, Double_t irnorm, int &ibin, PropData &pdata);
-///add data to the appropriate radial bin
-void AddDataToRadialBinInclusive(Options &opt, Double_t rval, Double_t massval,
+///add the data of a group, listed in increasing radius by indices, to the inclusive radial bins
+void AddDataToRadialBinsInclusive(Options &opt, const vector<Double_t> &radii, const vector<Double_t> &masses,
 #if defined(GASON) || defined(STARON) || defined(BHON)
-    Double_t srfval, int typeval,
+    const int *types,
 #endif
-    Double_t irnorm, int &ibin, PropData &pdata);
+    const vector<Int_t> &indices, Double_t irnorm, PropData &pdata);
 
 ///calculate extra hydro properties
 void GetExtraHydroProperties(Options &opt, PropData &pdata, Int_t n, Particle *Pval);
@@ -449,6 +445,26 @@ Int_t *GetSubstructureNum(Int_t ngroups);
 Int_t *GetParentID(Int_t ngroups);
 //@}
 
+/// \name Alternative 3D FOF engines
+/// see \ref fofengine.cxx for implementation
+//@{
+///build group ids, ordered by size, from the disjoint-set root of each particle
+Int_t *FOFRootsToGroupIDs(const Int_t nbodies, Particle *Part, Int_t *root, const Int_t minsize, Int_t &numgroups,
+    Int_tree_t *Head=NULL, Int_tree_t *Next=NULL);
+///3D FOF using a concurrent union-find over a single shared tree
+Int_t *FOFUnionFind(const Int_t nbodies, vector<Particle> &Part, KDTree *&tree, Double_t *param, Double_t *period,
+    const Int_t minsize, Int_t &numgroups, FOFcheckfunc fofcheck=NULL, Int_tree_t *Head=NULL, Int_tree_t *Next=NULL);
+///FOF using any link criterion, dispatched once to a compile-time specialised union-find search
+Int_t *FOFCriterionUnionFind(const Int_t nbodies, Particle *Part, KDTree *tree, FOFcompfunc fofcmp, Double_t *param,
+    const Int_t minsize, Int_t &numgroups, FOFcheckfunc check=NULL);
+///3D FOF using a uniform grid of Morton ordered cells at least a linking length wide
+Int_t *FOFGrid(Options &opt, const Int_t nbodies, vector<Particle> &Part, Double_t *param,
+    const Int_t minsize, Int_t &numgroups, FOFcheckfunc fofcheck=NULL, Int_tree_t *Head=NULL, Int_tree_t *Next=NULL);
+///nested 3D FOF group ids at several linking lengths found in a single pass
+Int_t **FOFMultiLinkingLength(Options &opt, const Int_t nbodies, vector<Particle> &Part, KDTree *&tree,
+    vector<Double_t> &ell2, const Int_t minsize, vector<Int_t> &numgroups);
+//@}
+
 #ifdef USEOPENMP
 /// \name OpenMP Search routines
 /// see \ref omproutines.cxx for implementation
@@ -811,10 +827,19 @@ Int_t **BuildPGListTyped(const Int_t nbodies, const Int_t numgroups, Int_t *numi
 Int_t **BuildPGList(const Int_t nbodies, const Int_t numgroups, Int_t *numingroup, Int_t *pfof, Particle *Part);
 ///build pglist but doesn't assume particles are in ID order
 Int_t **BuildPGList(const Int_t nbodies, const Int_t numgroups, Int_t *numingroup, Int_t *pfof, Int_t *ids);
+///stable parallel counting sort of particle indices by a dense integer key (such as group id), returning offsets and the sorted index list in caller supplied buffers
+void BuildCountingSort(const Int_t nbodies, const Int_t nkeys, Int_t *key, Int_t *noffset, Int_t *sortindex, Particle *Part=NULL);
+///build compressed group particle index list, with the particles of group i stored in pglist[noffset[i]..noffset[i+1]-1].
+///Returns noffset and if Part is given only lists particles of the given type in groups
+Int_t *BuildPGListCSR(const Int_t nbodies, const Int_t numgroups, Int_t *pfof, Int_t *&pglist, Particle *Part=NULL, int type=0);
 ///build the group particle arrays need for unbinding procedure
 Particle **BuildPartList(const Int_t numgroups, Int_t *numingroup, Int_t **pglist, Particle* Part, bool ikeepextrainfo = false);
 ///build a particle list subset using array of indices
 Particle *BuildPart(Int_t numingroup, Int_t *pglist, Particle* Part, bool ikeepextrainfo = false);
+///detach extra particle properties so that copies of the particles only carry the information needed for searches
+void DetachExtraProperties(const Int_t nbodies, Particle *Part, ExtraPropertiesStash &stash);
+///return extra particle properties detached with \ref DetachExtraProperties
+void ReattachExtraProperties(Particle *Part, ExtraPropertiesStash &stash);
 ///build the Head array which points to the head of the group a particle belongs to
 Int_tree_t *BuildHeadArray(const Int_t nbodies, const Int_t numgroups, Int_t *numingroup, Int_t **pglist);
 ///build the Next array which points to the next particle in the group
@@ -825,10 +850,14 @@ Int_tree_t *BuildLenArray(const Int_t nbodies, const Int_t numgroups, Int_t *num
 Int_tree_t *BuildGroupTailArray(const Int_t nbodies, const Int_t numgroups, Int_t *numingroup, Int_t **pglist);
 ///sort particles according to the group value (or technically any integer array) unique to each group and return an array of offsets to access the particle array via their group
 Int_t *BuildNoffset(const Int_t nbodies, Particle *Part, Int_t numgroups,Int_t *numingroup, Int_t *sortval, Int_t ioffset=0);
+///sort particles by radius using precomputed radius keys and a single in place permutation of the particles
+void SortParticlesByRadius(const Int_t n, Particle *Part);
 ///reorder groups from largest to smallest
 void ReorderGroupIDs(const Int_t numgroups, const Int_t newnumgroups, Int_t *numingroup, Int_t *pfof, Int_t **pglist);
 ///reorder groups from largest to smallest not assuming particles are in id order
 void ReorderGroupIDs(const Int_t numgroups, const Int_t newnumgroups, Int_t *numingroup, Int_t *pfof, Int_t **pglist, Particle *P);
+///reorder group ids using a compressed group particle list (see \ref BuildPGListCSR)
+void ReorderGroupIDs(const Int_t numgroups, const Int_t newnumgroups, Int_t *noffset, Int_t *pfof, Int_t *pglist);
 ///reorder groups by value
 void ReorderGroupIDsbyValue(const Int_t numgroups, const Int_t newnumgroups, Int_t *numingroup, Int_t *pfof, Int_t **pglist, Int_t *value);
 ///reorder groups and associated integer group data by value
@@ -839,6 +868,8 @@ void ReorderGroupIDsAndArraybyValue(const Int_t numgroups, const Int_t newnumgro
 void ReorderGroupIDsAndArraybyValue(const Int_t numgroups, const Int_t newnumgroups, Int_t *numingroup, Int_t *pfof, Int_t **pglist, Double_t *value, Int_t *gdata);
 ///reorder groups and associated double group data by value
 void ReorderGroupIDsAndArraybyValue(const Int_t numgroups, const Int_t newnumgroups, Int_t *numingroup, Int_t *pfof, Int_t **pglist, Double_t *value, Double_t *gdata);
+///reorder property data in place according to a list of old group ids
+void ReorderPropData(const Int_t numgroups, const Int_t newnumgroups, Int_t *order, PropData *pdata);
 ///reorder groups and the associated property data by value
 void ReorderGroupIDsAndHaloDatabyValue(const Int_t numgroups, const Int_t newnumgroups, Int_t *numingroup, Int_t *pfof, Int_t **pglist, Int_t *value, PropData *pdata);
 //@}
@@ -61,7 +61,7 @@ Int_t* SearchFullSet(Options &opt, const Int_t nbodies, vector<Particle> &Part,
     }
     OMP_Domain *ompdomain;
     int numompregions = ceil(nbodies/(float)opt.openmpfofsize);
-    bool runompfof = (numompregions>=2 && nthreads > 1 && opt.iopenmpfof == 1);
+    bool runompfof = (numompregions>=2 && nthreads > 1 && opt.iopenmpfof == 1 && opt.fofengine == FOFENGINETREE);
 #endif
     if (opt.p>0) {
         period=new Double_t[3];
@@ -213,8 +213,16 @@ Int_t* SearchFullSet(Options &opt, const Int_t nbodies, vector<Particle> &Part,
 #endif // USEOPENMP
     {
         vr::Timer t;
+        if (opt.fofengine==FOFENGINEUNIONFIND) {
+            pfof=FOFUnionFind(nbodies, Part, tree, param, period, minsize, numgroups,
+                (opt.partsearchtype==PSTALL && opt.iBaryonSearch>1)?fofcheck:NULL, Head, Next);
+        }
+        else if (opt.fofengine==FOFENGINEGRID) {
+            pfof=FOFGrid(opt, nbodies, Part, param, minsize, numgroups,
+                (opt.partsearchtype==PSTALL && opt.iBaryonSearch>1)?fofcheck:NULL, Head, Next);
+        }
         //posible alteration for all particle search
-        if (opt.partsearchtype==PSTALL && opt.iBaryonSearch>1) {
+        else if (opt.partsearchtype==PSTALL && opt.iBaryonSearch>1) {
             pfof=tree->FOFCriterionSetBasisForLinks(fofcmp,param,numgroups,minsize,
                 iorder,0,FOFchecktype,Head,Next);
         }
@@ -224,6 +232,26 @@ Int_t* SearchFullSet(Options &opt, const Int_t nbodies, vector<Particle> &Part,
         LOG(info) << "Finished FOF in " << t;
     }
 
+#ifndef USEMPI
+    //nested catalogues at additional linking lengths are found in one pass and written directly
+    if (opt.ellhalo3dmultixfac.size()>0) {
+        vector<Double_t> ell2(opt.ellhalo3dmultixfac.size());
+        vector<Int_t> numgroupslevel;
+        Int_t **pfoflevels;
+        bool ibuildtree = (tree == NULL);
+        for (auto k=0;k<ell2.size();k++) ell2[k]=pow(opt.ellxscale*opt.ellhalo3dmultixfac[k],2.0);
+        if (ibuildtree) tree = new KDTree(Part.data(),nbodies,opt.Bsize,tree->TPHYS,tree->KEPAN,1000,0,0,0,period);
+        pfoflevels = FOFMultiLinkingLength(opt, nbodies, Part, tree, ell2, minsize, numgroupslevel);
+        WriteFOFMultiLinkingLength(opt, nbodies, ell2.size(), pfoflevels);
+        for (auto k=0;k<ell2.size();k++) delete[] pfoflevels[k];
+        delete[] pfoflevels;
+        if (ibuildtree) {
+            delete tree;
+            tree = NULL;
+        }
+    }
+#endif
+
     MEMORY_USAGE_REPORT(debug, opt);
 
 #ifndef USEMPI
@@ -775,12 +803,11 @@ private(i,tid,xscaling,vscaling)
     //reorder ids in descending group size order only if not keeping FOF
     if (ng>0 && opt.iKeepFOF==0) {
         LOG(debug) << "Reordering " << ng << " groups ";
-        numingroup=BuildNumInGroup(Nlocal, ng, pfof);
-        Int_t **pglist=BuildPGList(Nlocal, ng, numingroup, pfof);
-        ReorderGroupIDs(ng, ng, numingroup, pfof, pglist);
-        for (i=1;i<=ng;i++) delete[] pglist[i];
+        Int_t *pglist;
+        noffset=BuildPGListCSR(Nlocal, ng, pfof, pglist);
+        ReorderGroupIDs(ng, ng, noffset, pfof, pglist);
         delete[] pglist;
-        delete[] numingroup;
+        delete[] noffset;
     }
 
     ///\todo only run this sort if necessary to keep id order
@@ -1004,8 +1031,11 @@ private(i,j,diff,gid)
     how the search should be localized. It should definitely be localized prior to CheckSignificance and the search window across mpi domains should use the larger
     physical search window used by the iterative search if that has been called.
  */
-Int_t* SearchSubset(Options &opt, const Int_t nbodies, const Int_t nsubset, Particle *Partsubset, Int_t &numgroups, Int_t sublevel, Int_t *pnumcores)
+Int_t* SearchSubset(Options &opt, const Int_t nbodies, const Int_t nsubset, Particle *Partsubset, Int_t &numgroups, Int_t sublevel, Int_t *pnumcores, SearchContext *psearch)
 {
+    //per object search state, either provided or taken from the options and stored back in them once done
+    SearchContext searchlocal(opt);
+    SearchContext &search = (psearch != NULL) ? *psearch : searchlocal;
     KDTree *tree;
     Int_t *pfof, i, ii;
     FOFcompfunc fofcmp;
@@ -1029,8 +1059,8 @@ Int_t* SearchSubset(Options &opt, const Int_t nbodies, const Int_t nsubset, Part
 #endif
 
 #ifdef USEMPI
-    //if using MPI on a single halo, lower minimum number
-    if (opt.iSingleHalo) opt.MinSize=MinNumMPI;
+    //if using MPI on a single halo, lower minimum number. Only written once as searches may share the options
+    if (opt.iSingleHalo && opt.MinSize!=MinNumMPI) opt.MinSize=MinNumMPI;
 #endif
 
     //set the maximum sublevel for halo core search. Unless star particles really should only be doing this at first sublevel
@@ -1074,7 +1104,7 @@ Int_t* SearchSubset(Options &opt, const Int_t nbodies, const Int_t nsubset, Part
     }
 
     if (opt.foftype==FOF6DSUBSET) {
-        param[2] = opt.HaloSigmaV*(opt.halocorevfac * opt.halocorevfac);
+        param[2] = search.HaloSigmaV*(opt.halocorevfac * opt.halocorevfac);
         param[7] = param[2];
     }
     param[8]=cos(opt.thetaopen*M_PI);
@@ -1141,7 +1171,8 @@ Int_t* SearchSubset(Options &opt, const Int_t nbodies, const Int_t nsubset, Part
         //if large enough for statistically significant structures to be found then search. This is a robust search
         if (nsubset>=MINSUBSIZE) {
             LOG(trace) << "Now search ...";
-            pfof=tree->FOFCriterion(fofcmp,param,numgroups,minsize,1,1,FOFchecksub);
+            if (opt.fofsubengine==FOFSUBENGINEUNIONFIND) pfof=FOFCriterionUnionFind(nsubset,Partsubset,tree,fofcmp,param,minsize,numgroups,FOFchecksub);
+            else pfof=tree->FOFCriterion(fofcmp,param,numgroups,minsize,1,1,FOFchecksub);
         }
         else {
             numgroups=0;
@@ -1157,15 +1188,17 @@ Int_t* SearchSubset(Options &opt, const Int_t nbodies, const Int_t nsubset, Part
         LOG(trace) << "Building tree ...";
         tree=new KDTree(Partsubset,nsubset,opt.Bsize,tree->TPHYS,tree->KEPAN,1000,1);
         LOG(trace) << "Finding nearest neighbours";
-        nnID=new Int_t*[nsubset];
-        for (i=0;i<nsubset;i++) nnID[i]=new Int_t[nsearch];
+        //neighbour lists are rows of a single contiguous matrix, the row pointers are only needed by FOFNNCriterion
+        nnID=new Int_t*[max(nsubset,(Int_t)1)];
+        nnID[0]=new Int_t[nsubset*nsearch];
+        for (i=1;i<nsubset;i++) nnID[i]=nnID[0]+i*nsearch;
         dist2=new Double_t*[nthreads];
         for (int j=0;j<nthreads;j++)dist2[j]=new Double_t[nsearch];
 #ifdef USEOPENMP
 #pragma omp parallel default(shared) \
 private(i,tid)
 {
-#pragma omp for
+#pragma omp for schedule(static)
 #endif
         for (i=0;i<nsubset;i++) {
 #ifdef USEOPENMP
@@ -1181,7 +1214,7 @@ private(i,tid)
         LOG(trace) << "Done";
         LOG(trace) << "Searching nearest neighbours";
         pfof=tree->FOFNNCriterion(fofcmp,param,nsearch,nnID,numgroups,minsize);
-        for (i=0;i<nsubset;i++) delete[] nnID[i];
+        delete[] nnID[0];
         delete[] nnID;
         for (i=0;i<nthreads;i++) delete[] dist2[i];
         delete[] dist2;
@@ -1248,7 +1281,7 @@ private(i,tid)
 
         //first identify all particles to be searched
         newlinks=0;
-        for (i=1;i<=numgroups;i++) if (numingroup[i]>opt.Ncell*0.1&&igflag[i]==0)
+        for (i=1;i<=numgroups;i++) if (numingroup[i]>search.Ncell*0.1&&igflag[i]==0)
         {
             ss=Head[pglist[i][0]];
             do {newlinksIndex[newlinks++]=ss;} while((ss = Next[ss]) >= 0);
@@ -1380,15 +1413,16 @@ private(i,tid)
         for (i=0;i<nsubset;i++) if (numingroup[pfof[i]]<opt.MinSize) pfof[i]=0;
         for (i=1;i<=numgroups;i++) numingroup[i]=0;
         for (i=0;i<nsubset;i++) numingroup[pfof[i]]++;
-        for (i=numgroups;i>=1;i--) {
-            if (numingroup[i]==0) ng--;
-            else pglist[i]=new Int_t[numingroup[i]];
-            numingroup[i]=0;
-        }
-        for (i=0;i<nsubset;i++) if (pfof[i]>0) pglist[pfof[i]][numingroup[pfof[i]]++]=i;
-        if (ng) ReorderGroupIDs(numgroups, ng, numingroup, pfof, pglist);
-        for (i=1;i<=numgroups;i++) if (numingroup[i]>0) delete[] pglist[i];
+        for (i=1;i<=numgroups;i++) if (numingroup[i]==0) ng--;
         delete[] pglist;
+        //the lists are only read to reorder the groups so are stored in a single compressed array
+        if (ng) {
+            Int_t *pglistoffset, *pglistflat;
+            pglistoffset=BuildPGListCSR(nsubset, numgroups, pfof, pglistflat);
+            ReorderGroupIDs(numgroups, ng, pglistoffset, pfof, pglistflat);
+            delete[] pglistflat;
+            delete[] pglistoffset;
+        }
         delete[] numingroup;
         numgroups=ng;
         LOG(trace) << "After expanded search there are now " << ng << " groups";
@@ -1416,34 +1450,35 @@ private(i,tid)
     //now search particle list for large compact substructures that are considered part of the background when using smaller grids
     if (nsubset>=MINSUBSIZE && opt.iLargerCellSearch && opt.foftype!=FOF6DCORE)
     {
-        //first have to delete tree used in search so that particles are in original particle order
-        //then construct a new grid with much larger cells so that new bg velocity dispersion can be estimated
+        //construct a new grid with much larger cells so that new bg velocity dispersion can be estimated
         LOG(trace) << "Entering large cell search " << opt.iLargerCellSearch;
-        delete tree;
         Int_t ngrid;
         Coordinate *gvel;
         Matrix *gveldisp;
         GridCell *grid;
-        Double_t nf, ncl=opt.Ncell;
+        Double_t nf, ncl=search.Ncell;
         //adjust ncellfac locally
         nf = std::min(opt.Ncellfac * Double_t{8}, Double_t{MAXCELLFRACTION});
-        opt.Ncell=nf*nsubset;
+        search.Ncell=nf*nsubset;
 
         //ONLY calculate grid quantities if substructures have been found
+        //the search tree is only rebuilt if the grid is, otherwise the existing tree is used for the bg search
         if (numgroups>0) {
-            tree=InitializeTreeGrid(opt,nsubset,Partsubset);
+            //first have to delete tree used in search so that particles are in original particle order
+            delete tree;
+            tree=InitializeTreeGrid(opt,nsubset,Partsubset,&search);
             ngrid=tree->GetNumLeafNodes();
             LOG(trace) << "bg search using " << ngrid << " grid cells, with each node containing ~"
-                       << (opt.Ncell = nsubset / ngrid) << " particles";
+                       << (search.Ncell = nsubset / ngrid) << " particles";
             grid=new GridCell[ngrid];
             FillTreeGrid(opt, nsubset, ngrid, tree, Partsubset, grid);
             gvel=GetCellVel(opt,nsubset,Partsubset,ngrid,grid);
             gveldisp=GetCellVelDisp(opt,nsubset,Partsubset,ngrid,grid,gvel);
             GetDenVRatio(opt,nsubset,Partsubset,ngrid,grid,gvel,gveldisp);
             GetOutliersValues(opt,nsubset,Partsubset,-1);
+            ///produce tree to search for 6d phase space structures
+            tree=new KDTree(Partsubset,nsubset,opt.Bsize,tree->TPHYS);
         }
-        ///produce tree to search for 6d phase space structures
-        tree=new KDTree(Partsubset,nsubset,opt.Bsize,tree->TPHYS);
 
         //now begin fof6d search for large background objects that are missed using smaller grid cells ONLY IF substructures have been found
         //this search can identify merger excited radial shells so for the moment, disabled
@@ -1455,7 +1490,7 @@ private(i,tid)
             param[1]=(opt.ellxscale*opt.ellxscale)*(opt.ellphys*opt.ellphys)*(opt.ellxfac*opt.ellxfac);
             param[6]=param[1];
             //velocity linking length from average sigmav from grid
-            param[7]=opt.HaloLocalSigmaV;
+            param[7]=search.HaloLocalSigmaV;
             param[8]=cos(opt.thetaopen*M_PI);
             param[9]=opt.ellthreshold*opt.ellfac;
             LOG(trace) << "FOF6D uses ellphys and ellvel";
@@ -1465,7 +1500,8 @@ private(i,tid)
             fofcmp=&FOF6dbgup;
             //here this ensures that particles belong to a 6dfof substructure that is composed of particles
             //which are considered dynamical outliers using a very large grid
-            pfofbg=tree->FOFCriterion(fofcmp,param,numgroupsbg,minsize,1,1,FOFchecksub);
+            if (opt.fofsubengine==FOFSUBENGINEUNIONFIND) pfofbg=FOFCriterionUnionFind(nsubset,Partsubset,tree,fofcmp,param,minsize,numgroupsbg,FOFchecksub);
+            else pfofbg=tree->FOFCriterion(fofcmp,param,numgroupsbg,minsize,1,1,FOFchecksub);
 
             //now combine results such that if particle already belongs to a substructure ignore
             //otherwise leave tagged. Then check if these new background substructures share enough links with the
@@ -1605,15 +1641,16 @@ private(i,tid)
                 for (i=1;i<=numgroups;i++) numingroup[i]=0;
                 for (i=0;i<nsubset;i++) numingroup[pfof[i]]++;
                 LOG(trace) << "Now determine number of groups with non zero length";
-                for (i=numgroups;i>=1;i--) {
-                    if (numingroup[i]==0) ng--;
-                    else pglist[i]=new Int_t[numingroup[i]];
-                    numingroup[i]=0;
-                }
-                for (i=0;i<nsubset;i++) if (pfof[i]>0) pglist[pfof[i]][numingroup[pfof[i]]++]=i;
-                if (ng) ReorderGroupIDs(numgroups, ng, numingroup, pfof, pglist);
-                for (i=1;i<=numgroups;i++) if (numingroup[i]>0) delete[] pglist[i];
+                for (i=1;i<=numgroups;i++) if (numingroup[i]==0) ng--;
                 delete[] pglist;
+                //the lists are only read to reorder the groups so are stored in a single compressed array
+                if (ng) {
+                    Int_t *pglistoffset, *pglistflat;
+                    pglistoffset=BuildPGListCSR(nsubset, numgroups, pfof, pglistflat);
+                    ReorderGroupIDs(numgroups, ng, pglistoffset, pfof, pglistflat);
+                    delete[] pglistflat;
+                    delete[] pglistoffset;
+                }
                 delete[] numingroup;
                 numgroups=ng;
                 LOG(trace) << "After expanded search there are now " << ng << " groups";
@@ -1681,7 +1718,7 @@ private(i,tid)
             param[1] = param[1] * param[1];
             param[6] = param[1];
             //velocity linking length from average sigmav from FINE SCALE grid
-            param[2] = opt.HaloSigmaV * (opt.halocorevfac * opt.halocorevfac);
+            param[2] = search.HaloSigmaV * (opt.halocorevfac * opt.halocorevfac);
             param[7] = param[2];
         }
 
@@ -1705,7 +1742,8 @@ private(i,tid)
         for (i=0;i<nsubset;i++) Partsubset[i].SetPotential(pfof[Partsubset[i].GetID()]);
         for (i=0;i<nsubset;i++) Partsubset[i].SetType(-1);
         param[9]=0.5;
-        pfofbg=tree->FOFCriterion(fofcmp,param,numgroupsbg,minsize,iorder,icheck,FOFcheckbg);
+        if (opt.fofsubengine==FOFSUBENGINEUNIONFIND) pfofbg=FOFCriterionUnionFind(nsubset,Partsubset,tree,fofcmp,param,minsize,numgroupsbg,FOFcheckbg);
+        else pfofbg=tree->FOFCriterion(fofcmp,param,numgroupsbg,minsize,iorder,icheck,FOFcheckbg);
 
         for (i=0;i<nsubset;i++) if (pfofbg[Partsubset[i].GetID()]<=1 && pfof[Partsubset[i].GetID()]==0) Partsubset[i].SetType(numactiveloops);
 
@@ -1752,7 +1790,8 @@ private(i,tid)
                 //we adjust the particles potentials so as to ignore already tagged particles using FOFcheckbg
                 //here since loop just iterates to search the largest core, we just set all previously tagged particles not belonging to main core as 1
                 for (i=0;i<nsubset;i++) Partsubset[i].SetPotential((pfofbgnew[Partsubset[i].GetID()]!=1)+(pfof[Partsubset[i].GetID()]>0));
-                pfofbg=tree->FOFCriterion(fofcmp,param,numgroupsbg,minsize,iorder,icheck,FOFcheckbg);
+                if (opt.fofsubengine==FOFSUBENGINEUNIONFIND) pfofbg=FOFCriterionUnionFind(nsubset,Partsubset,tree,fofcmp,param,minsize,numgroupsbg,FOFcheckbg);
+                else pfofbg=tree->FOFCriterion(fofcmp,param,numgroupsbg,minsize,iorder,icheck,FOFcheckbg);
                 //now if numgroupsbg is greater than one, need to update the pfofbgnew array
                 if (numgroupsbg>1) {
                     numactiveloops++;
@@ -1927,10 +1966,35 @@ private(i,tid)
     }
 
     LOG(trace) << "Done search for substructure in this subset";
+    if (psearch == NULL) search.Update(opt);
 
     return pfof;
 }
 
+///fill the core particle array, storing the mass, phase-space coordinates and core id (as the type) of the particles
+///in cores. If grouped is true the particles are placed contiguously by core id, with core i starting at noffset[i].
+///Only these quantities are needed to grow the cores, so the particles are not copied in full
+static void BuildCoreParticles(const Int_t nsubset, Particle *Partsubset, Int_t *pfofbg, Int_t numgroupsbg,
+    Particle *Pcore, vector<Int_t> &ncore, vector<Int_t> &noffset, bool grouped)
+{
+    Int_t pid, index, nincore=0;
+    vector<Int_t> count;
+    if (grouped) {
+        noffset[0]=noffset[1]=0;
+        for (Int_t i=2;i<=numgroupsbg;i++) noffset[i]=noffset[i-1]+ncore[i-1];
+        count=noffset;
+    }
+    for (Int_t i=0;i<nsubset;i++) {
+        pid=Partsubset[i].GetID();
+        if (pfofbg[pid]<=0) continue;
+        index = grouped ? count[pfofbg[pid]]++ : nincore++;
+        Pcore[index].SetMass(Partsubset[i].GetMass());
+        for (int k=0;k<6;k++) Pcore[index].SetPhase(k,Partsubset[i].GetPhase(k));
+        Pcore[index].SetID(pid);
+        Pcore[index].SetType(pfofbg[pid]);
+    }
+}
+
 //search for unassigned background particles if cores have been found.
 void HaloCoreGrowth(Options &opt, const Int_t nsubset, Particle *&Partsubset, Int_t *&pfof, Int_t *&pfofbg, Int_t &numgroupsbg, Double_t param[], vector<Double_t> &dispfac,
     int numactiveloops, vector<int> &corelevel,
@@ -1981,17 +2045,9 @@ void HaloCoreGrowth(Options &opt, const Int_t nsubset, Particle *&Partsubset, In
             GMatrix coredist(6,1);
             Int_t nactive=0;
 
-            //store particles
+            //store particles grouped by core
             Pcore=new Particle[nincore];
-            nincore=0;
-            for (i=0;i<nsubset;i++) if (pfofbg[Partsubset[i].GetID()]>0) {
-                Pcore[nincore]=Partsubset[i];
-                Pcore[nincore].SetType(pfofbg[Partsubset[i].GetID()]);
-                nincore++;
-            }
-            qsort(Pcore,nincore,sizeof(Particle),TypeCompare);
-            noffset[0]=noffset[1]=0;
-            for (i=2;i<=numgroupsbg;i++) noffset[i]=noffset[i-1]+ncore[i-1];
+            BuildCoreParticles(nsubset, Partsubset, pfofbg, numgroupsbg, Pcore, ncore, noffset, true);
             //now get centre of masses and dispersions
             for (i=1;i<=numgroupsbg;i++) {
                 cmphase[i]=CalcPhaseCM(ncore[i], &Pcore[noffset[i]]);
@@ -2106,16 +2162,8 @@ private(i,tid,Pval,D2,dval,mval,pid,weight)
                         nincore++;
                 Pcore=new Particle[nincore];
                 for (i=1;i<=numgroupsbg;i++) ncore[i]=0;
-                nincore=0;
-                for (i=0;i<nsubset;i++) if (pfofbg[Partsubset[i].GetID()]>0) {
-                    Pcore[nincore]=Partsubset[i];
-                    Pcore[nincore].SetType(pfofbg[Partsubset[i].GetID()]);
-                    nincore++;
-                    ncore[pfofbg[Partsubset[i].GetID()]]++;
-                }
-                qsort(Pcore,nincore,sizeof(Particle),TypeCompare);
-                noffset[0]=noffset[1]=0;
-                for (i=2;i<=numgroupsbg;i++) noffset[i]=noffset[i-1]+ncore[i-1];
+                for (i=0;i<nsubset;i++) if (pfofbg[i]>0) ncore[pfofbg[i]]++;
+                BuildCoreParticles(nsubset, Partsubset, pfofbg, numgroupsbg, Pcore, ncore, noffset, true);
                 //now get centre of masses and dispersions
                 for (i=1;i<=numgroupsbg;i++) if (corelevel[i]>=iloop) {
                     cmphase[i]=CalcPhaseCM(ncore[i], &Pcore[noffset[i]]);
@@ -2136,12 +2184,7 @@ private(i,tid,Pval,D2,dval,mval,pid,weight)
             if (nsearch>nincore) nsearch=nincore;
             if (nbucket>=nincore/8) nbucket=max(1,(int)nincore/8);
             Pcore=new Particle[nincore];
-            nincore=0;
-            for (i=0;i<nsubset;i++) if (pfofbg[Partsubset[i].GetID()]>0) {
-                Pcore[nincore]=Partsubset[i];
-                Pcore[nincore].SetType(pfofbg[Partsubset[i].GetID()]);
-                nincore++;
-            }
+            BuildCoreParticles(nsubset, Partsubset, pfofbg, numgroupsbg, Pcore, ncore, noffset, false);
             tcore=new KDTree(Pcore,nincore,opt.Bsize,tcore->TPHYS);
             nnID=new Int_t*[nthreads];
             dist2=new Double_t*[nthreads];
@@ -2276,6 +2319,7 @@ void MergeSubstructuresCoresPhase(Options &opt, const Int_t nsubset, Particle *&
     Double_t disp, dist2, mindist2, fdist2=pow(opt.coresubmergemindist,2.0);
     Coordinate pos;
     vector<Int_t> numingroup, noffset, taggedsubs;
+    Int_t ntagged;
     vector<Particle> subs, cores;
     KDTree *tree;
     //vector<GMatrix> phasetensorsubs(numsubs,GMatrix(6,6)), phasetensorcores(numcores,GMatrix(6,6));
@@ -2359,15 +2403,16 @@ void MergeSubstructuresCoresPhase(Options &opt, const Int_t nsubset, Particle *&
         sigXcores[i]*=1.0/cores[i].GetPotential();
         sigVcores[i]*=1.0/cores[i].GetPotential();
     }
-    //now built tree on substructures
+    //now built tree on substructures, with searches filling a buffer that can hold all substructures
     tree = new KDTree(subs.data(),numsubs,1,tree->TPHYS,tree->KEPAN,100,0,0,0);
+    taggedsubs.resize(numsubs);
     //tree = new KDTree(subs.data(),numlargesubs,1,tree->TPHYS,tree->KEPAN,100,0,0,0);
     //check all cores to see if they overlap significantly with substructures
     newnumcores=0;
     for (auto i=0;i<numcores;i++) {
         for (auto k=0;k<3;k++) pos[k]=cores[i].GetPosition(k);
-        taggedsubs = tree->SearchBallPosTagged(pos, sigXcores[i]*fdist2);
-        if (taggedsubs.size()==0) {
+        ntagged = tree->SearchBallPosTagged(pos, sigXcores[i]*fdist2, taggedsubs.data());
+        if (ntagged==0) {
             newnumcores++;
             cores[i].SetID(newnumcores+numsubs);
             continue;
@@ -2375,7 +2420,7 @@ void MergeSubstructuresCoresPhase(Options &opt, const Int_t nsubset, Particle *&
         //if objects are within search window of core, get min phase distance
         imerge=-1;
         mindist2=MAXVALUE;
-        for (auto j=0;j<taggedsubs.size();j++) {
+        for (auto j=0;j<ntagged;j++) {
             disp = 0; for (auto k=0;k<3;k++) disp+=pow(subs[taggedsubs[j]].GetPosition(k)-cores[i].GetPosition(k),2.0);
             dist2 = disp/sigXcores[i];
             disp = 0; for (auto k=0;k<3;k++) disp+=pow(subs[taggedsubs[j]].GetVelocity(k)-cores[i].GetVelocity(k),2.0);
@@ -2432,6 +2477,7 @@ void MergeSubstructuresPhase(Options &opt, const Int_t nsubset, Particle *&Parts
     Double_t xsub1, xsub2, vsub1, vsub2;
     Coordinate pos;
     vector<Int_t> numingroup, noffset, taggedsubs;
+    Int_t ntagged;
     struct mergeinfo {
         Int_t originalpfofval;
         Int_t pfofval;
@@ -2524,6 +2570,7 @@ void MergeSubstructuresPhase(Options &opt, const Int_t nsubset, Particle *&Parts
 
     //now built tree on substructures
     tree = new KDTree(subs.data(),subs.size(),1,tree->TPHYS,tree->KEPAN,100,0,0,0);
+    taggedsubs.resize(subs.size());
 
     //first check all cores to see if they overlap significantly with dynamically distince
     //substructures. Since cores are after subs in id value, this removes a core
@@ -2541,12 +2588,13 @@ void MergeSubstructuresPhase(Options &opt, const Int_t nsubset, Particle *&Parts
         searchdist = sigXsubs[index1]*fdist2;
         ////if object is background halo of type -1, decrease search distance^2 by 1/2^2
         //if (subs[i].GetType() == -1) searchdist *= 0.25;
-        taggedsubs = tree->SearchBallPosTagged(i, searchdist);
-        if (taggedsubs.size()<=1) continue;
+        for (auto k=0;k<3;k++) pos[k]=subs[i].GetPosition(k);
+        ntagged = tree->SearchBallPosTagged(pos, searchdist, taggedsubs.data());
+        if (ntagged<=1) continue;
         //if objects are within search window of core, get min phase distance
         imerge=-1;
         mindist2=MAXVALUE;
-        for (auto j=0;j<taggedsubs.size();j++)
+        for (auto j=0;j<ntagged;j++)
         {
             //object skips itself
             if (i==taggedsubs[j]) continue;
@@ -2705,7 +2753,7 @@ num_threads(nthreads) if (num > ompperiodnum)
 }
 
 ///Pre-calcualtions for searching for substructure
-inline void PreCalcSearchSubSet(Options &opt, Int_t subnumingroup,  Particle *&subPart, Int_t sublevel)
+inline void PreCalcSearchSubSet(Options &opt, SearchContext &search, Int_t subnumingroup,  Particle *&subPart, Int_t sublevel)
 {
     #ifndef USEMPI
     int ThisTask = 0;
@@ -2719,25 +2767,25 @@ inline void PreCalcSearchSubSet(Options &opt, Int_t subnumingroup,  Particle *&s
     LOG(debug) << "Substructure at sublevel " << sublevel << " with " << subnumingroup << " particles";
     if (subnumingroup>=MINSUBSIZE&&opt.foftype!=FOF6DCORE) {
         //now if object is large enough for phase-space decomposition and search, compare local field to bg field
-        opt.Ncell=opt.Ncellfac*subnumingroup;
+        search.Ncell=opt.Ncellfac*subnumingroup;
         //if ncell is such that uncertainty would be greater than 0.5% based on Poisson noise, increase ncell till above unless cell would contain >25%
-        while (opt.Ncell<MINCELLSIZE && subnumingroup/4.0>opt.Ncell) opt.Ncell*=2;
-        tree=InitializeTreeGrid(opt,subnumingroup,subPart);
+        while (search.Ncell<MINCELLSIZE && subnumingroup/4.0>search.Ncell) search.Ncell*=2;
+        tree=InitializeTreeGrid(opt,subnumingroup,subPart,&search);
         ngrid=tree->GetNumLeafNodes();
         grid=new GridCell[ngrid];
         FillTreeGrid(opt, subnumingroup, ngrid, tree, subPart, grid);
         gvel=GetCellVel(opt,subnumingroup,subPart,ngrid,grid);
         gveldisp=GetCellVelDisp(opt,subnumingroup,subPart,ngrid,grid,gvel);
 
-        opt.HaloLocalSigmaV=0;
-        for (auto j=0;j<ngrid;j++) opt.HaloLocalSigmaV+=pow(gveldisp[j].Det(),1./3.);opt.HaloLocalSigmaV/=(double)ngrid;
+        search.HaloLocalSigmaV=0;
+        for (auto j=0;j<ngrid;j++) search.HaloLocalSigmaV+=pow(gveldisp[j].Det(),1./3.);search.HaloLocalSigmaV/=(double)ngrid;
 
         Matrix eigvec(0.),I(0.);
         Double_t sigma2x,sigma2y,sigma2z;
         CalcVelSigmaTensor(subnumingroup, subPart, sigma2x, sigma2y, sigma2z, eigvec, I);
         //\todo need to update this
-        opt.HaloSigmaV=pow(sigma2x*sigma2y*sigma2z,1.0/3.0);
-        if (opt.HaloSigmaV>opt.HaloVelDispScale) opt.HaloVelDispScale=opt.HaloSigmaV;
+        search.HaloSigmaV=pow(sigma2x*sigma2y*sigma2z,1.0/3.0);
+        if (search.HaloSigmaV>search.HaloVelDispScale) search.HaloVelDispScale=search.HaloSigmaV;
 #ifdef HALOONLYDEN
         GetVelocityDensity(opt,subnumingroup,subPart);
 #endif
@@ -2749,7 +2797,7 @@ inline void PreCalcSearchSubSet(Options &opt, Int_t subnumingroup,  Particle *&s
         Matrix eigvec(0.),I(0.);
         Double_t sigma2x,sigma2y,sigma2z;
         CalcVelSigmaTensor(subnumingroup, subPart, sigma2x, sigma2y, sigma2z, eigvec, I);
-        opt.HaloLocalSigmaV=opt.HaloSigmaV=pow(sigma2x*sigma2y*sigma2z,1.0/3.0);
+        search.HaloLocalSigmaV=search.HaloSigmaV=pow(sigma2x*sigma2y*sigma2z,1.0/3.0);
     }
 }
 
@@ -2757,8 +2805,7 @@ inline void CleanAndUpdateGroupsFromSubSearch(Options &opt,
     Int_t &subnumingroup, Particle *subPart, Int_t *&subpfof,
     Int_t &subngroup, Int_t *&subsubnumingroup,
     Int_t **&subsubpglist, Int_t &numcores,
-    Int_t *&subpglist,
-    Int_t *&pfof, Int_t &ngroup, Int_t &ngroupidoffset)
+    Int_t *&subpglist)
 {
     bool iunbindflag;
     Int_t ng=subngroup;
@@ -2793,11 +2840,6 @@ inline void CleanAndUpdateGroupsFromSubSearch(Options &opt,
         }
     }
 
-    for (auto j=0;j<subnumingroup;j++)
-    {
-        if (subpfof[j]>0) pfof[subpglist[j]]=ngroup+ngroupidoffset+subpfof[j];
-    }
-    //ngroupidoffset+=subngroup;
     //now alter subsubpglist so that index pointed is global subset index as global subset is used to get the particles to be searched for subsubstructure
     for (auto j=1;j<=subngroup;j++)
     {
@@ -2830,6 +2872,129 @@ void UpdateGroupIDsFromSubstructure(Int_t activenumgroups, Int_t oldnumgroups,
     }
 }
 
+///minimum size of a (sub)structure to be searched for substructure at a given sublevel
+inline Int_t MinSizeForSubSearch(Options &opt, Int_t sublevel)
+{
+    Int_t minsizeforsubsearch = opt.MinSize*2;
+    for (auto i=1;i<sublevel;i++) minsizeforsubsearch=min(minsizeforsubsearch*2,(Int_t)MINSUBSIZE);
+    return minsizeforsubsearch;
+}
+
+/*!
+    Search a single (sub)structure for substructure and store the result in the node. The per object state set by
+    \ref PreCalcSearchSubSet is kept in a search context, so the options are only read and are shared by concurrent
+    searches. Substructures large enough to be searched in turn are added as children.
+*/
+void SearchSubSubNode(Options &opt, vector<Particle> &Partsubset, SubSearchNode *node)
+{
+    SearchContext search(opt);
+    Particle *subPart;
+    Int_t *subpfof, minsizeforsubsearch;
+
+    //extra properties are detached by \ref SearchSubSub for the duration of the search so these copies are light
+    subPart=new Particle[node->numingroup];
+    for (Int_t j=0;j<node->numingroup;j++) subPart[j]=Partsubset[node->pglist[j]];
+    //move to cm if desired
+    if (opt.icmrefadjust) {
+        //this routine is in substructureproperties.cxx. Has internal parallelisation
+        GMatrix cmphase = CalcPhaseCM(node->numingroup, subPart);
+        //this routine is within this file, also has internal parallelisation
+        AdjustSubPartToPhaseCM(node->numingroup, subPart, cmphase);
+    }
+    PreCalcSearchSubSet(opt, search, node->numingroup, subPart, node->sublevel);
+    subpfof = SearchSubset(opt, node->numingroup, node->numingroup, subPart,
+        node->ngroup, node->sublevel, &node->numcores, &search);
+    CleanAndUpdateGroupsFromSubSearch(opt, node->numingroup, subPart, subpfof,
+        node->ngroup, node->subnumingroup, node->subpglist, node->numcores,
+        node->pglist);
+    delete[] subpfof;
+    delete[] subPart;
+    node->HaloVelDispScale = search.HaloVelDispScale;
+
+    minsizeforsubsearch = MinSizeForSubSearch(opt, node->sublevel+1);
+    for (Int_t j=1;j<=node->ngroup;j++) if (node->subnumingroup[j]>=minsizeforsubsearch)
+        node->children.push_back(new SubSearchNode(node->sublevel+1, node->subnumingroup[j], node->subpglist[j]));
+}
+
+#ifdef USEOPENMP
+///search a node then immediately spawn tasks to search its children
+static void SearchSubSubTask(Options &opt, vector<Particle> &Partsubset, SubSearchNode *node)
+{
+    SearchSubSubNode(opt, Partsubset, node);
+    for (auto child:node->children) {
+        #pragma omp task default(shared) firstprivate(child)
+        SearchSubSubTask(opt, Partsubset, child);
+    }
+}
+#endif
+
+/*!
+    Search the hierarchy below the given (sub)structures for substructure. Objects with fewer than \ref ompsplitsubsearchnum
+    particles are searched as OpenMP tasks, where finishing the search of an object immediately spawns tasks for its
+    substructures, so objects at different levels of the hierarchy are searched concurrently rather than one level at a time.
+    A single producer thread spawns the tasks of the small objects first, then searches the larger objects itself while the
+    other threads work through the small ones, spawning tasks for the small substructures of each large object as soon
+    as it is done. The searches of the large objects therefore run on one thread, since the parallel regions within the
+    search routines are nested, but they overlap with the searches of the small hierarchies instead of delaying them.
+*/
+void SearchSubSubTree(Options &opt, vector<Particle> &Partsubset, vector<SubSearchNode*> &roots)
+{
+    vector<SubSearchNode*> pending;
+    SubSearchNode *node;
+#ifdef USEMPI
+    //searches of a single halo lower the minimum size, set this before the options are shared by concurrent searches
+    if (opt.iSingleHalo) opt.MinSize=MinNumMPI;
+#endif
+    //the largest dispersion scale is only tracked during the searches, so it is stored once they are all done
+    Double_t HaloVelDispScale = opt.HaloVelDispScale;
+#ifdef USEOPENMP
+    vector<SubSearchNode*> tasknodes;
+    for (auto root:roots) {
+        if (root->numingroup < ompsplitsubsearchnum) tasknodes.push_back(root);
+        else pending.push_back(root);
+    }
+    //start the largest objects first
+    sort(tasknodes.begin(), tasknodes.end(), [](SubSearchNode *a, SubSearchNode *b){
+        return a->numingroup > b->numingroup;
+    });
+    #pragma omp parallel default(shared) private(node)
+    {
+        #pragma omp single nowait
+        {
+            for (auto tasknode:tasknodes) {
+                #pragma omp task default(shared) firstprivate(tasknode)
+                SearchSubSubTask(opt, Partsubset, tasknode);
+            }
+            while (pending.size()>0) {
+                node = pending.back();
+                pending.pop_back();
+                SearchSubSubNode(opt, Partsubset, node);
+                if (node->HaloVelDispScale>HaloVelDispScale) HaloVelDispScale=node->HaloVelDispScale;
+                for (auto child:node->children) {
+                    if (child->numingroup >= ompsplitsubsearchnum) {
+                        pending.push_back(child);
+                        continue;
+                    }
+                    #pragma omp task default(shared) firstprivate(child)
+                    SearchSubSubTask(opt, Partsubset, child);
+                }
+            }
+        }
+    }
+#else
+    pending = roots;
+    while (pending.size()>0) {
+        node = pending.back();
+        pending.pop_back();
+        SearchSubSubNode(opt, Partsubset, node);
+        if (node->HaloVelDispScale>HaloVelDispScale) HaloVelDispScale=node->HaloVelDispScale;
+        for (auto child:node->children) pending.push_back(child);
+    }
+#endif
+    //as before, the velocity scale of the largest objects is kept
+    opt.HaloVelDispScale=HaloVelDispScale;
+}
+
 /*!
     Given a initial ordered candidate list of substructures, find all substructures that are large enough to be searched.
     These substructures are used as a mean background velocity field and a new outlier list is found and searched.
@@ -2845,28 +3010,26 @@ void UpdateGroupIDsFromSubstructure(Int_t activenumgroups, Int_t oldnumgroups,
     NOTE: if the code is altered and generalized to outliers in say the entropy distribution when searching for gas shocks,
     it might be possible to lower the cuts imposed.
 
-    \todo ADACS optimisation request. Here the function could be altered to employ better parallelisation. Specifically, the loop over
-    substructures at a given level could be parallelized (see for loop commented with ENCAPSULATE-01). Currently, at a given level in the substructure hierarchy
-    each object is searched sequentially but this does not need to be the case. It would require restructureing the loop and some of calls within
-    the loop so that the available pool of threads over which to run in parallel for the callled subroutines is adaptive. (Or it might be
-    simply more useful to not have the functions called within this loop parallelised. This loop invokes a few routines that have OpenMP
-    parallelisation: InitializeTreeGrid, GetCellVel, GetCellVelDisp, CalcVelSigmaTensor, etc.
+    The entire hierarchy is searched first (see \ref SearchSubSubTree), with the search of each object spawning the searches of its
+    substructures as soon as it finishes, so there is no synchronisation between levels of the hierarchy. Group ids are then assigned
+    one level at a time from the stored results, so they do not depend on the order in which searches complete.
 */
 void SearchSubSub(Options &opt, const Int_t nsubset, vector<Particle> &Partsubset, Int_t *&pfof, Int_t &ngroup, Int_t &nhalos, PropData *pdata)
 {
     //now build a sublist of groups to search for substructure
     Int_t nsubsearch, oldnsubsearch,sublevel,maxsublevel,ngroupidoffset,ngroupidoffsetold,ngrid;
     bool iflag,iunbindflag;
-    Particle *subPart;
     Int_t firstgroup,firstgroupoffset;
     Int_t ng,*numingroup,**pglist;
-    Int_t *subpfof,*subngroup;
+    Int_t *pglistoffset,*pglistflat;
+    Int_t *subngroup;
     Int_t *subnumingroup,**subpglist;
     Int_t **subsubnumingroup, ***subsubpglist;
     Int_t *numcores,*coreflag;
     Int_t *subpfofold;
     vector<Int_t> ngroupidoffset_old, ngroupidoffset_new;
-    vector<Int_t> ompactivesubgroups;
+    //tree of search results, with the nodes of the current and previous level of the hierarchy
+    vector<SubSearchNode*> levelnodes, prevlevelnodes, nextlevelnodes;
     //variables to keep track of structure level, pfof values (ie group ids) and their parent structure
     //use to point to current level
     StrucLevelData *pcsld;
@@ -2909,30 +3072,42 @@ void SearchSubSub(Options &opt, const Int_t nsubset, vector<Particle> &Partsubse
     iflag=(nsubsearch>0);
 
     if (iflag) {
-    if (opt.iBaryonSearch>=1 && opt.partsearchtype==PSTALL) pglist=BuildPGListTyped(nsubset, ngroup, numingroup, pfof,Partsubset.data(),DARKTYPE);
+    //the particle lists of the top level are only read by the search so are stored in a single compressed array
+    if (opt.iBaryonSearch>=1 && opt.partsearchtype==PSTALL) pglistoffset=BuildPGListCSR(nsubset, ngroup, pfof, pglistflat, Partsubset.data(), DARKTYPE);
 // #ifdef HIGHRES
 //     else pglist=BuildPGListTyped(nsubset, ngroup, numingroup, pfof,Partsubset.data(),DARKTYPE);
 // #else
-    else pglist=BuildPGList(nsubset, ngroup, numingroup, pfof);
+    else pglistoffset=BuildPGListCSR(nsubset, ngroup, pfof, pglistflat);
 // #endif
 
     //now store group ids of (sub)structures that will be searched for (sub)substructure.
     //since at level zero, the particle group list that is going to be used to calculate the background, outliers and searched through is simple pglist here
     //also the group size is simple numingroup
-    subnumingroup=new Int_t[nsubsearch+1];
-    subpglist=new Int_t*[nsubsearch+1];
-    for (Int_t i=1;i<=nsubsearch;i++) {
-        subnumingroup[i]=numingroup[indicestosearch[i-1]];
-        subpglist[i]=new Int_t[subnumingroup[i]];
-        for (Int_t j=0;j<subnumingroup[i];j++) subpglist[i][j]=pglist[indicestosearch[i-1]][j];
-    }
-    for (Int_t i=1;i<=ngroup;i++) delete[] pglist[i];
-    delete[] pglist;
-    delete[] numingroup;
-    //now start searching while there are still sublevels to be searched
+    for (Int_t i=1;i<=nsubsearch;i++)
+        levelnodes.push_back(new SubSearchNode(sublevel, numingroup[indicestosearch[i-1]], &pglistflat[pglistoffset[indicestosearch[i-1]]]));
+
+    //search the entire hierarchy first. Searches do not depend on the group ids assigned to other objects
+    //so these can run in any order, with group ids then assigned one level at a time below so that they are
+    //independent of the order in which searches finish
+    //the search only copies the phase-space, mass and density information of particles so extra properties
+    //are detached for the duration of the search rather than deep copied for every object searched
+    LOG(debug) << "Searching hierarchy below " << nsubsearch << " structures";
+    ExtraPropertiesStash extrastash;
+    DetachExtraProperties(nsubset, Partsubset.data(), extrastash);
+    SearchSubSubTree(opt, Partsubset, levelnodes);
+    ReattachExtraProperties(Partsubset.data(), extrastash);
+    MEMORY_USAGE_REPORT(debug, opt);
+
+    //now update group ids while there are still sublevels to be processed
     while (iflag) {
         LOG(debug) << "There are " << nsubsearch << " substructures large enough to search for other substructures at sub level " << sublevel;
         oldnsubsearch=nsubsearch;
+        subnumingroup=new Int_t[nsubsearch+1];
+        subpglist=new Int_t*[nsubsearch+1];
+        for (Int_t i=1;i<=nsubsearch;i++) {
+            subnumingroup[i]=levelnodes[i-1]->numingroup;
+            subpglist[i]=levelnodes[i-1]->pglist;
+        }
         subsubnumingroup=new Int_t*[nsubsearch+1];
         subsubpglist=new Int_t**[nsubsearch+1];
         subngroup=new Int_t[nsubsearch+1];
@@ -2945,107 +3120,21 @@ void SearchSubSub(Options &opt, const Int_t nsubset, vector<Particle> &Partsubse
         ngroupidoffset_new[1] = ngroupidoffset;
         ngroupidoffset_old[1] = ngroupidoffset;
         for (auto i=2;i<=oldnsubsearch;i++) ngroupidoffset_old[i] = ngroupidoffset_old[i-1]+ceil(subnumingroup[i-1]/opt.MinSize)+1;
-#ifdef USEOPENMP
-        //vector that will store the subgroups that are small
-        //enough to be searched fully in parallel.
-        ompactivesubgroups.resize(0);
-#endif
         LOG(debug) << "Going through sublevel " << sublevel;
-        MEMORY_USAGE_REPORT(debug, opt);
 
         for (Int_t i=1;i<=oldnsubsearch;i++) {
-            // try running loop over largest objects in serial with parallel inside calls
-            // so skip of group is small enough and running with openmp
-#ifdef USEOPENMP
-            if (subnumingroup[i] < ompsplitsubsearchnum) {
-                ompactivesubgroups.push_back(i);
-                continue;
-            }
-#endif
+            SubSearchNode *node=levelnodes[i-1];
             subpfofold[i]=pfof[subpglist[i][0]];
-            subPart=new Particle[subnumingroup[i]];
-            for (Int_t j=0;j<subnumingroup[i];j++) {
-                subPart[j]=Partsubset[subpglist[i][j]];
-#ifdef GASON
-                if (subPart[j].HasHydroProperties()) subPart[j].SetHydroProperties();
-#endif
-#ifdef STARON
-                if (subPart[j].HasStarProperties()) subPart[j].SetStarProperties();
-#endif
-#ifdef BHON
-                if (subPart[j].HasBHProperties()) subPart[j].SetBHProperties();
-#endif
-#ifdef EXTRADMON
-                if (subPart[j].HasExtraDMProperties()) subPart[j].SetExtraDMProperties();
-#endif
-            }
-            //move to cm if desired
-            if (opt.icmrefadjust) {
-                //this routine is in substructureproperties.cxx. Has internal parallelisation
-                GMatrix cmphase = CalcPhaseCM(subnumingroup[i], subPart);
-                //this routine is within this file, also has internal parallelisation
-                AdjustSubPartToPhaseCM(subnumingroup[i], subPart, cmphase);
-            }
-            PreCalcSearchSubSet(opt, subnumingroup[i], subPart, sublevel);
-            subpfof = SearchSubset(opt, subnumingroup[i], subnumingroup[i], subPart,
-                subngroup[i], sublevel, &numcores[i]);
-            CleanAndUpdateGroupsFromSubSearch(opt, subnumingroup[i], subPart, subpfof,
-                    subngroup[i], subsubnumingroup[i], subsubpglist[i], numcores[i],
-                    subpglist[i], pfof, ngroup, ngroupidoffset_old[i]);
-            delete[] subpfof;
-            delete[] subPart;
+            subngroup[i]=node->ngroup;
+            numcores[i]=node->numcores;
+            subsubnumingroup[i]=node->subnumingroup;
+            subsubpglist[i]=node->subpglist;
+            for (Int_t j=1;j<=subngroup[i];j++)
+                for (Int_t k=0;k<subsubnumingroup[i][j];k++)
+                    pfof[subsubpglist[i][j][k]]=ngroup+ngroupidoffset_old[i]+j;
             ns+=subngroup[i];
         }
 
-
-#ifdef USEOPENMP
-        if (ompactivesubgroups.size()>0) {
-            Int_t oldns = ns;
-            ns = 0;
-            Options opt2;
-            #pragma omp parallel for \
-            default(shared) private(subPart, subpfof, opt2) schedule(dynamic) \
-            reduction(+:ns)
-            for (auto iomp=0;iomp<ompactivesubgroups.size();iomp++) {
-                Int_t i=ompactivesubgroups[iomp];
-                opt2 = opt;
-                subpfofold[i] = pfof[subpglist[i][0]];
-                subPart = new Particle[subnumingroup[i]];
-                for (Int_t j=0;j<subnumingroup[i];j++) {
-                    subPart[j] = Partsubset[subpglist[i][j]];
-#ifdef GASON
-                    if (subPart[j].HasHydroProperties()) subPart[j].SetHydroProperties();
-#endif
-#ifdef STARON
-                    if (subPart[j].HasStarProperties()) subPart[j].SetStarProperties();
-#endif
-#ifdef BHON
-                    if (subPart[j].HasBHProperties()) subPart[j].SetBHProperties();
-#endif
-#ifdef EXTRADMON
-                    if (subPart[j].HasExtraDMProperties()) subPart[j].SetExtraDMProperties();
-#endif
-                }
-
-                if (opt.icmrefadjust) {
-                    //this routine is in substructureproperties.cxx. Has internal parallelisation
-                    GMatrix cmphase = CalcPhaseCM(subnumingroup[i], subPart);
-                    //this routine is within this file, also has internal parallelisation
-                    AdjustSubPartToPhaseCM(subnumingroup[i], subPart, cmphase);
-                }
-                PreCalcSearchSubSet(opt2, subnumingroup[i], subPart, sublevel);
-                subpfof = SearchSubset(opt2, subnumingroup[i], subnumingroup[i], subPart,
-                    subngroup[i], sublevel, &numcores[i]);
-                CleanAndUpdateGroupsFromSubSearch(opt2, subnumingroup[i], subPart, subpfof,
-                        subngroup[i], subsubnumingroup[i], subsubpglist[i], numcores[i],
-                        subpglist[i], pfof, ngroup, ngroupidoffset_old[i]);
-                delete[] subpfof;
-                delete[] subPart;
-                ns += subngroup[i];
-            }
-            ns += oldns;
-        }
-#endif
         UpdateGroupIDsFromSubstructure(oldnsubsearch, ngroup,
             pfof, subngroup, subnumingroup, subpglist,
             ns, ngroupidoffset, ngroupidoffset_old, ngroupidoffset_new);
@@ -3144,39 +3233,19 @@ void SearchSubSub(Options &opt, const Int_t nsubset, vector<Particle> &Partsubse
         }
         LOG(debug) << "Finished searching substructures to sublevel " << sublevel;
         sublevel++;
-        minsizeforsubsearch=min(minsizeforsubsearch*2,MINSUBSIZE);
-        for (Int_t i=1;i<=oldnsubsearch;i++) delete[] subpglist[i];
         delete[] subpglist;
         delete[] subnumingroup;
-        nsubsearch=0;
-        //after looping over all level sublevel substructures adjust nsubsearch, set subpglist subnumingroup, so that can move to next level.
-        for (Int_t i=1;i<=oldnsubsearch;i++)
-            for (Int_t j=1;j<=subngroup[i];j++) if (subsubnumingroup[i][j]>=minsizeforsubsearch)
-                nsubsearch++;
-        if (nsubsearch>0) {
-            subnumingroup=new Int_t[nsubsearch+1];
-            subpglist=new Int_t*[nsubsearch+1];
-            nsubsearch=1;
-            for (Int_t i=1;i<=oldnsubsearch;i++) {
-                for (Int_t j=1;j<=subngroup[i];j++)
-                    if (subsubnumingroup[i][j]>=minsizeforsubsearch) {
-                        subnumingroup[nsubsearch]=subsubnumingroup[i][j];
-                        subpglist[nsubsearch]=new Int_t[subnumingroup[nsubsearch]];
-                        for (Int_t k=0;k<subnumingroup[nsubsearch];k++) subpglist[nsubsearch][k]=subsubpglist[i][j][k];
-                        nsubsearch++;
-                    }
-            }
-            nsubsearch--;
-        }
-        else iflag=false;
-        //free memory
-        for (Int_t i=1;i<=oldnsubsearch;i++) {
-            if (subngroup[i]>0) {
-                for (Int_t j=1;j<=subngroup[i];j++) delete[] subsubpglist[i][j];
-                delete[] subsubnumingroup[i];
-                delete[] subsubpglist[i];
-            }
-        }
+        //the next level is the substructures large enough to have been searched, in order of their group id
+        nextlevelnodes.clear();
+        for (auto node:levelnodes)
+            nextlevelnodes.insert(nextlevelnodes.end(), node->children.begin(), node->children.end());
+        //the particle lists of this level point to the substructures found at the previous level, which are no longer needed
+        for (auto node:prevlevelnodes) delete node;
+        prevlevelnodes=levelnodes;
+        levelnodes=nextlevelnodes;
+        nsubsearch=levelnodes.size();
+        iflag=(nsubsearch>0);
+        //free memory, substructure lists themselves are owned by the nodes
         delete[] subsubnumingroup;
         delete[] subsubpglist;
         delete[] subngroup;
@@ -3185,6 +3254,10 @@ void SearchSubSub(Options &opt, const Int_t nsubset, vector<Particle> &Partsubse
         LOG(debug) << "Finished storing next level of substructures to be searched for subsubstructure";
     }
 
+    for (auto node:prevlevelnodes) delete node;
+    delete[] pglistflat;
+    delete[] pglistoffset;
+    delete[] numingroup;
     ngroup+=ngroupidoffset;
     LOG(info) << "Done searching substructure to " << sublevel - 1 << " sublevels";
     }
@@ -3295,9 +3368,28 @@ void SearchSubSub(Options &opt, const Int_t nsubset, vector<Particle> &Partsubse
     MEMORY_USAGE_REPORT(debug, opt);
 }
 
+/*!
+    Cheap upper bound on the significance a group can reach in \ref CheckSignificance, where the particles with the lowest
+    ell values are removed until the group is significant or has fewer than minsize members. With n-m particles removed,
+    the mean of the remaining m is at most maxell and at most that of the total less n-m particles at minell.
+    Returns false only if no size from minsize to n-1 reaches the significance level even with this bound (allowing for
+    round off in the running mean), in which case the group would be removed by the full check anyway.
+*/
+inline bool SignificanceReachable(Int_t n, Double_t aveell, Double_t minell, Double_t maxell,
+    Double_t ellaveexp, Double_t siglevel, Int_t minsize)
+{
+    Double_t sum=aveell*n, slack=1e-6*max(fabs(minell),fabs(maxell)), meanmax;
+    for (Int_t m=max(minsize,(Int_t)1);m<n;m++) {
+        meanmax=min(maxell,(sum-(n-m)*minell)/(Double_t)m)+slack;
+        if ((meanmax/ellaveexp-1.0)*sqrt((Double_t)m)>=siglevel) return true;
+    }
+    return false;
+}
+
 /*!
     Check significance of group using significance parameter.  A group is considered significant if (ave/expected ave) (and possibly (max-min)/varexpected] is significant relative to Poisson noise.
-    If a group is not start removing particle with lowest ell value.
+    If a group is not start removing particle with lowest ell value. Groups that cannot become significant before
+    falling below the minimum size (see \ref SignificanceReachable) are removed directly from their moments.
 */
 int CheckSignificance(Options &opt, const Int_t nsubset, Particle *Partsubset, Int_t &numgroups, Int_t *numingroup, Int_t *pfof, Int_t **pglist)
 {
@@ -3346,22 +3438,55 @@ private(i)
 #pragma omp for
 #endif
         for (i=1;i<=numgroups;i++) {
+            if(betaave[i]<opt.siglevel && !SignificanceReachable(numingroup[i], aveell[i], minell[i], maxell[i], ellaveexp, opt.siglevel, opt.MinSize)) {
+                for (Int_t j=0;j<numingroup[i];j++) pfof[Partsubset[pglist[i][j]].GetID()]=0;
+                numingroup[i]=-1;
+                continue;
+            }
             if(betaave[i]<opt.siglevel) {
+                //particles are removed in order of increasing ell, one per distinct value (the last in the list with that value)
+                //until the group is significant. Sorting the ell values once gives each next minimum directly rather than
+                //rescanning the group after every removal
+                //position is the current list position of the particle initially at a given position and member the inverse
+                Int_t n=numingroup[i], k=0, kend;
+                vector<pair<Double_t,Int_t>> ellorder(n);
+                vector<Int_t> position(n), member(n);
+                for (Int_t j=0;j<n;j++) {
+                    ellorder[j]=make_pair(Partsubset[pglist[i][j]].GetPotential(),j);
+                    position[j]=member[j]=j;
+                }
+                sort(ellorder.begin(),ellorder.end());
                 do {
                     if ((numingroup[i])<opt.MinSize) {
                         for (Int_t j=0;j<numingroup[i];j++) pfof[Partsubset[pglist[i][j]].GetID()]=0;
                         numingroup[i]=-1;
                         break;
                     }
-                    Int_t iminell;
+                    Int_t iminell=-1, jmax;
                     Double_t vminell=minell[i];
                     aveell[i]=(aveell[i]*(Double_t)numingroup[i]-minell[i])/(Double_t)(numingroup[i]-1.0);
-                    minell[i]=maxell[i];
-                    for (Int_t j=0;j<numingroup[i];j++)
-                        if(Partsubset[pglist[i][j]].GetPotential()>vminell&&Partsubset[pglist[i][j]].GetPotential()<minell[i])minell[i]=Partsubset[pglist[i][j]].GetPotential();
-                        else if (Partsubset[pglist[i][j]].GetPotential()==vminell) iminell=j;
+                    //find the particles with the minimum value, once all values have been used only the maximum remains
+                    if (k==n) {k=0;while (ellorder[k].first!=vminell) k++;}
+                    kend=k;
+                    while (kend<n && ellorder[kend].first==vminell) kend++;
+                    for (Int_t kk=k;kk<kend;kk++) {
+                        jmax=position[ellorder[kk].second];
+                        if (jmax<numingroup[i] && jmax>iminell) iminell=jmax;
+                    }
+                    if (iminell==-1) {
+                        for (Int_t j=0;j<numingroup[i];j++) pfof[Partsubset[pglist[i][j]].GetID()]=0;
+                        numingroup[i]=-1;
+                        break;
+                    }
+                    minell[i]=(kend<n)?ellorder[kend].first:maxell[i];
+                    k=kend;
                     pfof[Partsubset[pglist[i][iminell]].GetID()]=0;
-                    if (iminell!=numingroup[i]-1)pglist[i][iminell]=pglist[i][numingroup[i]-1];
+                    position[member[iminell]]=numingroup[i];
+                    if (iminell!=numingroup[i]-1) {
+                        pglist[i][iminell]=pglist[i][numingroup[i]-1];
+                        member[iminell]=member[numingroup[i]-1];
+                        position[member[iminell]]=iminell;
+                    }
                     numingroup[i]--;
                     betaave[i]=(aveell[i]/ellaveexp-1.0)*sqrt((Double_t)numingroup[i]);
                 } while(betaave[i]<opt.siglevel);
@@ -3417,7 +3542,6 @@ Int_t* SearchBaryons(Options &opt, Int_t &nbaryons, Particle *&Pbaryons, const I
     Coordinate x1;
     Particle p1;
     int icheck;
-    FOFcompfunc fofcmp;
     Double_t param[20];
     int nsearch=opt.Nvel;
     Int_t *nnID=NULL,*numingroup;
@@ -3573,8 +3697,8 @@ Int_t* SearchBaryons(Options &opt, Int_t &nbaryons, Particle *&Pbaryons, const I
     else param[2]=opt.HaloVelDispScale*16.0;//here use factor of 4 in local dispersion //could remove entirely and just use global dispersion but this will over compensate.
     param[7]=param[2];
 
-    //Set fof type
-    fofcmp=&FOF6d;
+    //Set fof type, the criterion is fixed for this search so use the inlined policy
+    FOF6dLink link6d(param);
     if (LOG_ENABLED(debug)) {
         LOG(debug) << "Baryon search " << nbaryons;
         LOG(debug) << "FOF6D uses ellphys and ellvel";
@@ -3624,7 +3748,7 @@ private(i,tid,p1,pindex,x1,D2,dval,rval,icheck,nnID,dist2,baryonfofold)
             if (opt.partsearchtype==PSTALL) icheck=((pfofdark[pindex]>nhalos)||(pfofdark[pindex]==baryonfofold));
             else icheck=(numingroup[pfofbaryons[i]]<numingroup[pfofdark[pindex]]);
             if (icheck) {
-                if (fofcmp(p1,Part[nnID[j]],param)) {
+                if (link6d(p1,Part[nnID[j]])) {
                     for (int k=0;k<3;k++) {
                         D2+=(p1.GetPosition(k)-Part[nnID[j]].GetPosition(k))*(p1.GetPosition(k)-Part[nnID[j]].GetPosition(k))/param[6]+(p1.GetVelocity(k)-Part[nnID[j]].GetVelocity(k))*(p1.GetVelocity(k)-Part[nnID[j]].GetVelocity(k))/param[7];
                     }
@@ -320,6 +320,256 @@ private(j,Pval,x,y,z,massval)
     LOG(debug) << "Done getting CM in " << timer;
 }
 
+///Count the number and mass of each particle type in a group in a single pass, optionally including the mass of hot gas
+static void GetParticleTypeCounts(Options &opt, PropData &pdata, Int_t n, Particle *Part, bool ihotgasmass)
+{
+    Particle *Pval;
+    Double_t mval, SFR=0, temp;
+    int type;
+    for (Int_t j=0;j<n;j++) {
+        Pval=&Part[j];
+        type=Pval->GetType();
+#ifndef NOMASS
+        mval = Pval->GetMass();
+#else
+        mval = opt.MassValue;
+#endif
+#ifdef EXTRADMON
+        if (type==DARKTYPE) pdata.n_dm++;
+#endif
+#ifdef GASON
+        if (type==GASTYPE) {
+            pdata.n_gas++;
+#ifdef STARON
+            SFR=Pval->GetSFR();
+            if (SFR>opt.gas_sfr_threshold) pdata.M_gas_sf+=mval;
+            else pdata.M_gas_nsf+=mval;
+#endif
+            if (ihotgasmass) {
+                temp=Pval->GetTemperature();
+                if (temp > opt.temp_max_cut && SFR <= 0) pdata.M_gas_highT+=mval;
+            }
+        }
+#endif
+#ifdef STARON
+        if (type==STARTYPE) {
+            pdata.n_star++;
+            pdata.M_star+=mval;
+        }
+#endif
+#ifdef BHON
+        if (type==BHTYPE) {
+            pdata.n_bh++;
+            pdata.M_bh+=mval;
+        }
+#endif
+#ifdef HIGHRES
+        if (type == DARK2TYPE || type == DARK3TYPE || (type==DARKTYPE&&Pval->GetMass()>opt.zoomlowmassdm)) {
+            pdata.n_interloper++;
+            pdata.M_interloper+=mval;
+        }
+#endif
+    }
+}
+
+/// \name Mark properties that are skipped for an object with \ref PROPUNSETVALUE, or \ref PROPUNSETSIGNEDVALUE if they can be negative
+//@{
+static inline void SetUnsetValues(vector<float> &x)
+{
+    for (auto &val:x) val=PROPUNSETVALUE;
+}
+static inline void SetUnsetValues(vector<Coordinate> &x)
+{
+    for (auto &val:x) val[0]=val[1]=val[2]=PROPUNSETVALUE;
+}
+static inline void SetUnsetSignedValues(vector<Coordinate> &x)
+{
+    for (auto &val:x) val[0]=val[1]=val[2]=PROPUNSETSIGNEDVALUE;
+}
+template<typename T> static inline void SetUnsetExtraPropertyFields(T &prop,
+    vector<string> &outnames1, vector<string> &outnames2, vector<string> &outnames3)
+{
+    for (auto &name:outnames1) prop.SetInternalProperties(name, PROPUNSETVALUE);
+    for (auto &name:outnames2) prop.SetChemistry(name, PROPUNSETVALUE);
+    for (auto &name:outnames3) prop.SetChemistryProduction(name, PROPUNSETVALUE);
+}
+
+///Aperture quantities of an object below \ref Options.apertureminsize. Particle counts stay zero
+static void SetUnsetApertureQuantities(Options &opt, PropData &pdata)
+{
+    SetUnsetValues(pdata.aperture_mass);
+    SetUnsetValues(pdata.aperture_veldisp);
+    SetUnsetValues(pdata.aperture_vrdisp);
+    SetUnsetValues(pdata.aperture_rhalfmass);
+    SetUnsetValues(pdata.aperture_mass_proj);
+    SetUnsetValues(pdata.aperture_rhalfmass_proj);
+    SetUnsetSignedValues(pdata.aperture_L);
+#if defined(GASON) || defined(STARON) || defined(BHON)
+    SetUnsetValues(pdata.aperture_mass_dm);
+    SetUnsetValues(pdata.aperture_veldisp_dm);
+    SetUnsetValues(pdata.aperture_vrdisp_dm);
+    SetUnsetValues(pdata.aperture_rhalfmass_dm);
+#endif
+#ifdef GASON
+    SetUnsetValues(pdata.aperture_mass_gas);
+    SetUnsetValues(pdata.aperture_veldisp_gas);
+    SetUnsetValues(pdata.aperture_vrdisp_gas);
+    SetUnsetValues(pdata.aperture_SFR_gas);
+    SetUnsetValues(pdata.aperture_Z_gas);
+    SetUnsetValues(pdata.aperture_rhalfmass_gas);
+    SetUnsetSignedValues(pdata.aperture_L_gas);
+    SetUnsetValues(pdata.aperture_mass_proj_gas);
+    SetUnsetValues(pdata.aperture_rhalfmass_proj_gas);
+    SetUnsetValues(pdata.aperture_SFR_proj_gas);
+    SetUnsetValues(pdata.aperture_Z_proj_gas);
+    for (auto &prop:pdata.aperture_properties_gas)
+        SetUnsetExtraPropertyFields(prop, opt.gas_internalprop_output_names_aperture,
+            opt.gas_chem_output_names_aperture, opt.gas_chemproduction_output_names_aperture);
+#ifdef STARON
+    SetUnsetValues(pdata.aperture_mass_gas_sf);
+    SetUnsetValues(pdata.aperture_veldisp_gas_sf);
+    SetUnsetValues(pdata.aperture_vrdisp_gas_sf);
+    SetUnsetValues(pdata.aperture_rhalfmass_gas_sf);
+    SetUnsetValues(pdata.aperture_Z_gas_sf);
+    SetUnsetSignedValues(pdata.aperture_L_gas_sf);
+    SetUnsetValues(pdata.aperture_mass_proj_gas_sf);
+    SetUnsetValues(pdata.aperture_rhalfmass_proj_gas_sf);
+    SetUnsetValues(pdata.aperture_Z_proj_gas_sf);
+    SetUnsetValues(pdata.aperture_mass_gas_nsf);
+    SetUnsetValues(pdata.aperture_veldisp_gas_nsf);
+    SetUnsetValues(pdata.aperture_vrdisp_gas_nsf);
+    SetUnsetValues(pdata.aperture_rhalfmass_gas_nsf);
+    SetUnsetValues(pdata.aperture_Z_gas_nsf);
+    SetUnsetSignedValues(pdata.aperture_L_gas_nsf);
+    SetUnsetValues(pdata.aperture_mass_proj_gas_nsf);
+    SetUnsetValues(pdata.aperture_rhalfmass_proj_gas_nsf);
+    SetUnsetValues(pdata.aperture_Z_proj_gas_nsf);
+    SetUnsetValues(pdata.aperture_M_gas_highT);
+    SetUnsetValues(pdata.aperture_Temp_mean_gas_highT);
+    SetUnsetValues(pdata.aperture_Z_mean_gas_highT);
+#endif
+#endif
+#ifdef STARON
+    SetUnsetValues(pdata.aperture_mass_star);
+    SetUnsetValues(pdata.aperture_veldisp_star);
+    SetUnsetValues(pdata.aperture_vrdisp_star);
+    SetUnsetValues(pdata.aperture_rhalfmass_star);
+    SetUnsetValues(pdata.aperture_Z_star);
+    SetUnsetSignedValues(pdata.aperture_L_star);
+    SetUnsetValues(pdata.aperture_mass_proj_star);
+    SetUnsetValues(pdata.aperture_rhalfmass_proj_star);
+    SetUnsetValues(pdata.aperture_Z_proj_star);
+    for (auto &prop:pdata.aperture_properties_star)
+        SetUnsetExtraPropertyFields(prop, opt.star_internalprop_output_names_aperture,
+            opt.star_chem_output_names_aperture, opt.star_chemproduction_output_names_aperture);
+#endif
+#ifdef BHON
+    SetUnsetValues(pdata.aperture_mass_bh);
+    SetUnsetValues(pdata.aperture_mass_proj_bh);
+    SetUnsetSignedValues(pdata.aperture_L_bh);
+    for (auto &prop:pdata.aperture_properties_bh)
+        SetUnsetExtraPropertyFields(prop, opt.bh_internalprop_output_names_aperture,
+            opt.bh_chem_output_names_aperture, opt.bh_chemproduction_output_names_aperture);
+#endif
+#ifdef HIGHRES
+    SetUnsetValues(pdata.aperture_mass_interloper);
+    SetUnsetValues(pdata.aperture_mass_proj_interloper);
+#endif
+#ifdef EXTRADMON
+    for (auto &prop:pdata.aperture_properties_extra_dm)
+        for (auto &name:opt.extra_dm_internalprop_output_names_aperture) prop.SetExtraProperties(name, PROPUNSETVALUE);
+#endif
+}
+
+///Quantities within the radius of maximum circular velocity, skipped if \ref PROPKERNELRVMAX is disabled or the object is below \ref Options.rvmaxminsize
+static void SetUnsetRVmaxQuantities(PropData &pdata)
+{
+    pdata.RV_sigma_v=pdata.RV_lambda_B=pdata.RV_lambda_P=pdata.RV_Krot=PROPUNSETVALUE;
+    pdata.RV_J[0]=pdata.RV_J[1]=pdata.RV_J[2]=PROPUNSETSIGNEDVALUE;
+    pdata.RV_veldisp=Matrix((Double_t)PROPUNSETSIGNEDVALUE);
+}
+
+///Axis ratios and eigenvectors, skipped if \ref PROPKERNELMORPHOLOGY is disabled or the object is below \ref Options.morphologyminsize.
+///The gas and star morphology is also skipped if \ref PROPKERNELPARTTYPES is disabled, in which case ihalo is false
+static void SetUnsetMorphology(PropData &pdata, bool ihalo)
+{
+    if (ihalo) {
+        pdata.gq=pdata.gs=pdata.RV_q=pdata.RV_s=PROPUNSETVALUE;
+        pdata.geigvec=pdata.RV_eigvec=Matrix((Double_t)PROPUNSETSIGNEDVALUE);
+    }
+#ifdef GASON
+    pdata.q_gas=pdata.s_gas=PROPUNSETVALUE;
+    pdata.eigvec_gas=Matrix((Double_t)PROPUNSETSIGNEDVALUE);
+#endif
+#ifdef STARON
+    pdata.q_star=pdata.s_star=PROPUNSETVALUE;
+    pdata.eigvec_star=Matrix((Double_t)PROPUNSETSIGNEDVALUE);
+#endif
+}
+
+///Scalar gas and star properties, skipped if \ref PROPKERNELPARTTYPES is disabled. Particle numbers, the gas mass from \ref GetCM
+///and the masses from \ref GetParticleTypeCounts are always calculated, while centres of mass, angular momenta and dispersion tensors stay zero
+static void SetUnsetParticleTypeProperties(PropData &pdata)
+{
+#ifdef GASON
+    pdata.M_gas_rvmax=pdata.M_gas_30kpc=pdata.M_gas_50kpc=pdata.M_gas_500c=PROPUNSETVALUE;
+    pdata.M_200crit_excl_gas=pdata.M_200mean_excl_gas=pdata.M_BN98_excl_gas=PROPUNSETVALUE;
+    pdata.Krot_gas=pdata.T_gas=pdata.Rhalfmass_gas=PROPUNSETVALUE;
+    pdata.Temp_gas=pdata.Z_gas=pdata.SFR_gas=PROPUNSETVALUE;
+    pdata.Temp_mean_gas=pdata.Z_mean_gas=pdata.SFR_mean_gas=PROPUNSETVALUE;
+#ifdef STARON
+    pdata.M_200crit_excl_gas_sf=pdata.M_200mean_excl_gas_sf=pdata.M_BN98_excl_gas_sf=PROPUNSETVALUE;
+    pdata.Krot_gas_sf=pdata.Rhalfmass_gas_sf=pdata.sigV_gas_sf=PROPUNSETVALUE;
+    pdata.Temp_gas_sf=pdata.Z_gas_sf=pdata.Temp_mean_gas_sf=pdata.Z_mean_gas_sf=PROPUNSETVALUE;
+    pdata.M_200crit_excl_gas_nsf=pdata.M_200mean_excl_gas_nsf=pdata.M_BN98_excl_gas_nsf=PROPUNSETVALUE;
+    pdata.Krot_gas_nsf=pdata.Rhalfmass_gas_nsf=pdata.sigV_gas_nsf=PROPUNSETVALUE;
+    pdata.Temp_gas_nsf=pdata.Z_gas_nsf=pdata.Temp_mean_gas_nsf=pdata.Z_mean_gas_nsf=PROPUNSETVALUE;
+#endif
+#endif
+#ifdef STARON
+    pdata.M_star_rvmax=pdata.M_star_30kpc=pdata.M_star_50kpc=pdata.M_star_500c=PROPUNSETVALUE;
+    pdata.M_200crit_excl_star=pdata.M_200mean_excl_star=pdata.M_BN98_excl_star=PROPUNSETVALUE;
+    pdata.Krot_star=pdata.T_star=pdata.Rhalfmass_star=PROPUNSETVALUE;
+    pdata.t_star=pdata.Z_star=pdata.t_mean_star=pdata.Z_mean_star=PROPUNSETVALUE;
+#endif
+}
+
+///Extra gas, star, black hole and dark matter properties, skipped if \ref PROPKERNELPARTTYPES is disabled or the object
+///is below \ref Options.extrapropminsize
+static void SetUnsetExtraProperties(Options &opt, PropData &pdata)
+{
+#ifdef GASON
+    SetUnsetExtraPropertyFields(pdata.hydroprop, opt.gas_internalprop_output_names,
+        opt.gas_chem_output_names, opt.gas_chemproduction_output_names);
+#endif
+#ifdef STARON
+    SetUnsetExtraPropertyFields(pdata.starprop, opt.star_internalprop_output_names,
+        opt.star_chem_output_names, opt.star_chemproduction_output_names);
+#endif
+#ifdef BHON
+    SetUnsetExtraPropertyFields(pdata.bhprop, opt.bh_internalprop_output_names,
+        opt.bh_chem_output_names, opt.bh_chemproduction_output_names);
+#endif
+#ifdef EXTRADMON
+    for (auto &name:opt.extra_dm_internalprop_output_names) pdata.extradmprop.SetExtraProperties(name, PROPUNSETVALUE);
+#endif
+}
+
+///Store \ref PROPUNSETVALUE in every non-negative property of an object that \ref GetProperties skipped, and
+///\ref PROPUNSETSIGNEDVALUE in the signed ones, so that they can be told apart from calculated values in the output
+static void SetUnsetProperties(Options &opt, PropData &pdata, Int_t num)
+{
+    bool itypekernel = (opt.ipropertykernels & PROPKERNELPARTTYPES);
+    if (!(opt.ipropertykernels & PROPKERNELROTATION)) pdata.Krot=PROPUNSETVALUE;
+    if (!(opt.ipropertykernels & PROPKERNELRVMAX) || num<opt.rvmaxminsize) SetUnsetRVmaxQuantities(pdata);
+    if (!(opt.ipropertykernels & PROPKERNELMORPHOLOGY) || num<opt.morphologyminsize) SetUnsetMorphology(pdata, true);
+    else if (!itypekernel) SetUnsetMorphology(pdata, false);
+    if (!itypekernel) SetUnsetParticleTypeProperties(pdata);
+    if (!itypekernel || num<opt.extrapropminsize) SetUnsetExtraProperties(opt, pdata);
+    if (opt.iaperturecalc && num<opt.apertureminsize) SetUnsetApertureQuantities(opt, pdata);
+}
+//@}
+
 /*!
     The routine is used to calculate bulk object properties. It assumes that particles have been
     arranged in group order and the indexing offsets between groups is given by noffset
@@ -328,6 +578,10 @@ private(j,Pval,x,y,z,massval)
     For small groups it is more efficient to parallize across groups, whereas for large groups containing many particles, we loop over the particles
     to sum quantities.
 
+    The mass, centre of mass, angular momentum, dispersion, maximum circular velocity and overdensity quantities are always
+    calculated as the other properties use them. The remaining groups of properties (rotational support, quantities within Rmax,
+    morphology, per particle type properties) are only calculated if enabled in \ref Options.ipropertykernels
+
  */
 void GetProperties(Options &opt, const Int_t nbodies, Particle *Part, Int_t ngroup, Int_t *&pfof, Int_t *&numingroup, PropData *&pdata, Int_t *&noffset)
 {
@@ -366,6 +620,12 @@ void GetProperties(Options &opt, const Int_t nbodies, Particle *Part, Int_t ngro
 
     vector<Double_t> SOlgrhovals;
 
+    //property kernels enabled in the config
+    bool irotkernel = (opt.ipropertykernels & PROPKERNELROTATION);
+    bool irvkernel = (opt.ipropertykernels & PROPKERNELRVMAX);
+    bool imorphkernel = (opt.ipropertykernels & PROPKERNELMORPHOLOGY);
+    bool itypekernel = (opt.ipropertykernels & PROPKERNELPARTTYPES);
+
     int iSOfound;
     if (opt.SOnum >0) {
         SOlgrhovals.resize(opt.SOnum);
@@ -385,6 +645,19 @@ void GetProperties(Options &opt, const Int_t nbodies, Particle *Part, Int_t ngro
         }
     }
 
+    //order groups by decreasing size so that the dynamic schedules below start the most expensive groups first
+    //and fill in with the many small groups, rather than a large group being picked up last by a single thread.
+    //Groups handled by the large group path (>=omppropnum) come first in this order
+    vector<Int_t> grouporder(ngroup);
+    Int_t nlargegroups=0;
+    for (i=1;i<=ngroup;i++) {
+        grouporder[i-1]=i;
+        if (numingroup[i]>=omppropnum) nlargegroups++;
+    }
+    stable_sort(grouporder.begin(), grouporder.end(), [&numingroup](Int_t a, Int_t b) {
+        return numingroup[a]>numingroup[b];
+    });
+
     //for all groups, move particles to their appropriate reference frame
 #ifdef USEOPENMP
 #pragma omp parallel default(shared)  \
@@ -392,8 +665,9 @@ private(i,j,k,Pval,cmref)
 {
     #pragma omp for schedule(dynamic) nowait
 #endif
-    for (i=1;i<=ngroup;i++)
+    for (ii=0;ii<ngroup;ii++)
     {
+        i=grouporder[ii];
         if (opt.iPropertyReferencePosition == PROPREFCM) cmref=pdata[i].gcm;
         else if (opt.iPropertyReferencePosition == PROPREFMBP) cmref=pdata[i].gposmbp;
         else if (opt.iPropertyReferencePosition == PROPREFMINPOT) cmref=pdata[i].gposminpot;
@@ -402,12 +676,13 @@ private(i,j,k,Pval,cmref)
             Pval=&Part[j+noffset[i]];
             for (k=0;k<3;k++) Pval->SetPosition(k, Pval->GetPosition(k) - cmref[k]);
         }
-        //sort by radius (here use gsl_heapsort as no need to allocate more memory
-        gsl_heapsort(&Part[noffset[i]], numingroup[i], sizeof(Particle), RadCompare);
+        //sort by radius, large groups are sorted below using all threads
+        if (numingroup[i]<omppropnum) SortParticlesByRadius(numingroup[i], &Part[noffset[i]]);
     }
 #ifdef USEOPENMP
 }
 #endif
+    for (i=1;i<=ngroup;i++) if (numingroup[i]>=omppropnum) SortParticlesByRadius(numingroup[i], &Part[noffset[i]]);
 
     //for small groups loop over groups
 #ifdef USEOPENMP
@@ -418,8 +693,9 @@ private(EncMassSF,EncMassNSF,Krot_sf,Krot_nsf,Ekin_sf,Ekin_nsf)
 {
     #pragma omp for schedule(dynamic) nowait
 #endif
-    for (i=1;i<=ngroup;i++) if (numingroup[i]<omppropnum)
+    for (ii=nlargegroups;ii<ngroup;ii++)
     {
+        i=grouporder[ii];
         //if (opt.iInclusiveHalo == 0 && pdata[i].hostid==-1) pdata[i].gMFOF=pdata[i].gmass;
         pdata[i].gsize=Part[noffset[i]+numingroup[i]-1].Radius();
         RV_num = 0;
@@ -525,6 +801,7 @@ private(EncMassSF,EncMassNSF,Krot_sf,Krot_nsf,Ekin_sf,Ekin_nsf)
         //this is defined as the specific angular momentum about the angular momentum
         //axis (see sales et al 2010)
         RV_Ekin=0;
+        if (irotkernel) {
         for (j=0;j<numingroup[i];j++) {
             Pval=&Part[j+noffset[i]];
             #ifndef NOMASS
@@ -542,8 +819,10 @@ private(EncMassSF,EncMassNSF,Krot_sf,Krot_nsf,Ekin_sf,Ekin_nsf)
             if (Rdist>0) pdata[i].Krot+=mval*(jzval*jzval/(Rdist*Rdist));
         }
         pdata[i].Krot*=0.5/Ekin;
+        }
 
         //now calculate stuff within RV knowing particle array sorted according to radius
+        if (irvkernel && numingroup[i]>=opt.rvmaxminsize) {
         for (j=0;j<RV_num;j++) {
             Pval=&Part[j+noffset[i]];
             rc=Pval->Radius();
@@ -592,32 +871,13 @@ private(EncMassSF,EncMassNSF,Krot_sf,Krot_nsf,Ekin_sf,Ekin_nsf)
             if (Rdist>0) pdata[i].RV_Krot+=mval*(jzval*jzval/(Rdist*Rdist));
         }
         pdata[i].RV_Krot*=0.5/RV_Ekin;
-
-#if defined(EXTRADMON)
-        for (j=0;j<numingroup[i];j++) {
-            if (Part[j+noffset[i]].GetType() != DARKTYPE) continue;
-            pdata[i].n_dm++;
         }
-#endif
+
+        //number and mass of each particle type
+        GetParticleTypeCounts(opt, pdata[i], numingroup[i], &Part[noffset[i]], false);
         //baryons
 #if defined(GASON)
-        for (j=0;j<numingroup[i];j++) {
-            Pval=&Part[j+noffset[i]];
-            if (Pval->GetType()==GASTYPE) {
-                pdata[i].n_gas++;
-#ifndef NOMASS
-                mval = Pval->GetMass();
-#else
-                mval = opt.MassValue;
-#endif
-                //pdata[i].M_gas+=mval;
-#ifdef STARON
-                SFR=Pval->GetSFR();
-                if (SFR>opt.gas_sfr_threshold) pdata[i].M_gas_sf+=mval;
-                else pdata[i].M_gas_nsf+=mval;
-#endif
-            }
-        }
+        if (itypekernel) {
         Ekin=0;
         for (j=0;j<numingroup[i];j++) {
             Pval=&Part[j+noffset[i]];
@@ -925,21 +1185,11 @@ private(EncMassSF,EncMassNSF,Krot_sf,Krot_nsf,Ekin_sf,Ekin_nsf)
             if (pdata[i].M_gas_nsf>0) pdata[i].Krot_gas_nsf/=Ekin_nsf;
 #endif
         }
-        if (pdata[i].n_gas>=PROPMORPHMINNUM) GetGlobalSpatialMorphology(numingroup[i], &Part[noffset[i]], pdata[i].q_gas, pdata[i].s_gas, 1e-2, pdata[i].eigvec_gas,0,GASTYPE,0);
+        if (imorphkernel && numingroup[i]>=opt.morphologyminsize && pdata[i].n_gas>=PROPMORPHMINNUM) GetGlobalSpatialMorphology(numingroup[i], &Part[noffset[i]], pdata[i].q_gas, pdata[i].s_gas, 1e-2, pdata[i].eigvec_gas,0,GASTYPE,0);
+        }
 #endif
 #ifdef STARON
-        for (j=0;j<numingroup[i];j++) {
-            Pval=&Part[j+noffset[i]];
-            if (Pval->GetType()==STARTYPE) {
-                pdata[i].n_star++;
-                #ifndef NOMASS
-                mval = Pval->GetMass();
-                #else
-                mval = opt.MassValue;
-                #endif
-                pdata[i].M_star+=mval;
-            }
-        }
+        if (itypekernel) {
         Ekin=0;
         for (j=0;j<numingroup[i];j++) {
             Pval=&Part[j+noffset[i]];
@@ -1122,23 +1372,11 @@ private(EncMassSF,EncMassNSF,Krot_sf,Krot_nsf,Ekin_sf,Ekin_nsf)
             pdata[i].Krot_star /= Ekin;
             pdata[i].T_star = Ekin;
         }
-        if (pdata[i].n_star>=PROPMORPHMINNUM) GetGlobalSpatialMorphology(numingroup[i], &Part[noffset[i]], pdata[i].q_star, pdata[i].s_star, 1e-2, pdata[i].eigvec_star,0,STARTYPE,0);
-#endif
-
-#ifdef BHON
-        for (j=0;j<numingroup[i];j++) {
-            Pval=&Part[j+noffset[i]];
-            if (Pval->GetType()==BHTYPE) {
-                pdata[i].n_bh++;
-#ifndef NOMASS
-                mval = Pval->GetMass();
-#else
-                mval = opt.MassValue;
-#endif
-                pdata[i].M_bh+=mval;
-            }
+        if (imorphkernel && numingroup[i]>=opt.morphologyminsize && pdata[i].n_star>=PROPMORPHMINNUM) GetGlobalSpatialMorphology(numingroup[i], &Part[noffset[i]], pdata[i].q_star, pdata[i].s_star, 1e-2, pdata[i].eigvec_star,0,STARTYPE,0);
         }
 #endif
+
+        if (itypekernel && numingroup[i]>=opt.extrapropminsize) {
 #ifdef GASON
         GetExtraHydroProperties(opt, pdata[i], numingroup[i], &Part[noffset[i]]);
 #endif
@@ -1151,38 +1389,20 @@ private(EncMassSF,EncMassNSF,Krot_sf,Krot_nsf,Ekin_sf,Ekin_nsf)
 #ifdef EXTRADMON
         GetExtraDMProperties(opt, pdata[i], numingroup[i], &Part[noffset[i]]);
 #endif
-
-#ifdef HIGHRES
-        for (j=0;j<numingroup[i];j++) {
-            Pval=&Part[j+noffset[i]];
-            if (Pval->GetType() == DARK2TYPE || Pval->GetType() == DARK3TYPE || (Pval->GetType()==DARKTYPE&&Pval->GetMass()>opt.zoomlowmassdm))
-            {
-                pdata[i].n_interloper++;
-                #ifndef NOMASS
-                mval = Pval->GetMass();
-                #else
-                mval = opt.MassValue;
-                #endif
-                pdata[i].M_interloper+=mval;
-            }
         }
-#endif
+
         //calculate aperture quantities
-        CalculateApertureQuantities(opt, numingroup[i], &Part[noffset[i]], pdata[i]);
+        if (numingroup[i]>=opt.apertureminsize) CalculateApertureQuantities(opt, numingroup[i], &Part[noffset[i]], pdata[i]);
         //if calculating profiles
         if (opt.iprofilecalc) {
             double irnorm;
-            //as particles are radially sorted, init the radial bin at zero
-            int ibin=0;
             if (opt.iprofilenorm == PROFILERNORMR200CRIT) irnorm = 1.0/pdata[i].gR200c;
             else irnorm = 1.0;
-            for (j=0;j<numingroup[i];j++) {
-                Pval = &Part[noffset[i] + j];
-                AddParticleToRadialBin(opt,Pval,irnorm,ibin,pdata[i]);
-            }
+            AddParticlesToRadialBins(opt, numingroup[i], &Part[noffset[i]], irnorm, pdata[i]);
         }
 
         //morphology calcs
+        if (imorphkernel && numingroup[i]>=opt.morphologyminsize) {
 #ifdef NOMASS
         GetGlobalSpatialMorphology(numingroup[i], &Part[noffset[i]], pdata[i].gq, pdata[i].gs, 1e-2, pdata[i].geigvec,0);
         //calculate morphology based on particles within RV, the radius of maximum circular velocity
@@ -1191,6 +1411,7 @@ private(EncMassSF,EncMassNSF,Krot_sf,Krot_nsf,Ekin_sf,Ekin_nsf)
         GetGlobalSpatialMorphology(numingroup[i], &Part[noffset[i]], pdata[i].gq, pdata[i].gs, 1e-2, pdata[i].geigvec,1);
         if (RV_num>=PROPMORPHMINNUM) GetGlobalSpatialMorphology(RV_num, &Part[noffset[i]], pdata[i].RV_q, pdata[i].RV_s, 1e-2, pdata[i].RV_eigvec,1);
 #endif
+        }
     }
 #ifdef USEOPENMP
 }
@@ -1315,6 +1536,7 @@ private(j,Pval,rc,x,y,z,vx,vy,vz,J,mval)
             pdata[i].glambda_B=pdata[i].gJ.Length()/(pdata[i].gM200c*sqrt(2.0*opt.G*pdata[i].gM200c*pdata[i].gR200c));
         }
         //rotational support calculation
+        if (irotkernel) {
 #ifdef USEOPENMP
 #pragma omp parallel default(shared) \
 private(j,Pval,mval,x,y,z,vx,vy,vz,jval,jzval,zdist,Rdist)
@@ -1344,6 +1566,7 @@ private(j,Pval,mval,x,y,z,vx,vy,vz,jval,jzval,zdist,Rdist)
 }
 #endif
         pdata[i].Krot=0.5*Krot/Ekin;
+        }
         vc = 0;
         EncMass=0;
 	Double_t oldrc = 0;
@@ -1374,6 +1597,7 @@ private(j,Pval,mval,x,y,z,vx,vy,vz,jval,jzval,zdist,Rdist)
 	}
 
         //now that we have radius of maximum circular velocity, lets calculate properties internal to this radius
+        if (irvkernel && numingroup[i]>=opt.rvmaxminsize) {
         Ekin=Jx=Jy=Jz=sxx=sxy=sxz=syy=syz=szz=Krot=0.;
 #ifdef USEOPENMP
 #pragma omp parallel default(shared) \
@@ -1449,39 +1673,13 @@ private(j,Pval,mval,x,y,z,vx,vy,vz,jval,jzval,zdist,Rdist)
 }
 #endif
         pdata[i].RV_Krot=0.5*Krot/Ekin;
-#if defined(EXTRADMON)
-        for (j=0;j<numingroup[i];j++) {
-            if (Part[j+noffset[i]].GetType() != DARKTYPE) continue;
-            pdata[i].n_dm++;
         }
-#endif
+        //number and mass of each particle type
+        GetParticleTypeCounts(opt, pdata[i], numingroup[i], &Part[noffset[i]], true);
     //baryons
 #if defined(GASON)
-        for (j=0;j<numingroup[i];j++) {
-            Pval=&Part[j+noffset[i]];
-            if (Pval->GetType()==GASTYPE) {
-                pdata[i].n_gas++;
-                #ifndef NOMASS
-                mval = Pval->GetMass();
-                #else
-                mval = opt.MassValue;
-                #endif
-                //pdata[i].M_gas+=mval;
-                #ifdef STARON
-                SFR = Pval->GetSFR();
-                if (SFR>opt.gas_sfr_threshold) pdata[i].M_gas_sf+=mval;
-                else pdata[i].M_gas_nsf+=mval;
-                #endif
-                #if (defined(GASON)) || (defined(GASON) && defined(SWIFTINTERFACE))
-		temp=Pval->GetTemperature();
-                if (temp > opt.temp_max_cut && SFR <= 0) {
-  			pdata[i].M_gas_highT+=mval;
-		}
-		#endif
-            }
-        }
         //calculate properties if there are gas particles
-        if (pdata[i].n_gas>0) {
+        if (itypekernel && pdata[i].n_gas>0) {
         Ekin=Krot=Jx=Jy=Jz=sxx=sxy=sxz=syy=syz=szz=0.;
         Tsum=tsum=Zsum=sfrsum=0.;
         Tmeansum=tmeansum=Zmeansum=sfrmeansum=0.;
@@ -1827,24 +2025,12 @@ private(j,Pval,x,y,z,vx,vy,vz,jval,jzval,zdist,Rdist,mval)
         if (pdata[i].M_gas_nsf>0) pdata[i].Krot_gas_nsf=Krot_nsf/Ekin_nsf;
 #endif
         }
-        if (pdata[i].n_gas>=PROPMORPHMINNUM) GetGlobalSpatialMorphology(numingroup[i], &Part[noffset[i]], pdata[i].q_gas, pdata[i].s_gas, 1e-2, pdata[i].eigvec_gas,0,GASTYPE,0);
+        if (imorphkernel && numingroup[i]>=opt.morphologyminsize && pdata[i].n_gas>=PROPMORPHMINNUM) GetGlobalSpatialMorphology(numingroup[i], &Part[noffset[i]], pdata[i].q_gas, pdata[i].s_gas, 1e-2, pdata[i].eigvec_gas,0,GASTYPE,0);
         }//end of if statement checking that there are gas particles
 #endif
 
 #ifdef STARON
-        for (j=0;j<numingroup[i];j++) {
-            Pval=&Part[j+noffset[i]];
-            if (Pval->GetType()==STARTYPE) {
-                pdata[i].n_star++;
-#ifndef NOMASS
-                mval = Pval->GetMass();
-#else
-                mval = opt.MassValue;
-#endif
-                pdata[i].M_star+=mval;
-            }
-        }
-        if (pdata[i].n_star>0) {
+        if (itypekernel && pdata[i].n_star>0) {
         Ekin=Krot=Jx=Jy=Jz=sxx=sxy=sxz=syy=syz=szz=0.;
         tsum=Zsum=0.;
         tmeansum=Zmeansum=0.;
@@ -2056,25 +2242,11 @@ private(j,Pval,x,y,z,vx,vy,vz,jval,jzval,zdist,Rdist)
         pdata[i].T_star=0.5*Ekin;
         }
 
-        if (pdata[i].n_star>=PROPMORPHMINNUM) GetGlobalSpatialMorphology(numingroup[i], &Part[noffset[i]], pdata[i].q_star, pdata[i].s_star, 1e-2, pdata[i].eigvec_star,0,STARTYPE,0);
+        if (imorphkernel && numingroup[i]>=opt.morphologyminsize && pdata[i].n_star>=PROPMORPHMINNUM) GetGlobalSpatialMorphology(numingroup[i], &Part[noffset[i]], pdata[i].q_star, pdata[i].s_star, 1e-2, pdata[i].eigvec_star,0,STARTYPE,0);
         }//end of calculations if stars are present
 #endif
 
-#ifdef BHON
-        for (j=0;j<numingroup[i];j++) {
-            Pval=&Part[j+noffset[i]];
-            if (Pval->GetType()==BHTYPE) {
-                pdata[i].n_bh++;
-#ifndef NOMASS
-                mval = Pval->GetMass();
-#else
-                mval = opt.MassValue;
-#endif
-                pdata[i].M_bh+=mval;
-            }
-        }
-#endif
-
+        if (itypekernel && numingroup[i]>=opt.extrapropminsize) {
 #ifdef GASON
         GetExtraHydroProperties(opt, pdata[i], numingroup[i], &Part[noffset[i]]);
 #endif
@@ -2087,23 +2259,9 @@ private(j,Pval,x,y,z,vx,vy,vz,jval,jzval,zdist,Rdist)
 #ifdef EXTRADMON
         GetExtraDMProperties(opt, pdata[i], numingroup[i], &Part[noffset[i]]);
 #endif
-
-#ifdef HIGHRES
-        for (j=0;j<numingroup[i];j++) {
-            Pval=&Part[j+noffset[i]];
-            if (Pval->GetType() == DARK2TYPE || Pval->GetType() == DARK3TYPE || (Pval->GetType()==DARKTYPE&&Pval->GetMass()>opt.zoomlowmassdm))
-            {
-                pdata[i].n_interloper++;
-#ifndef NOMASS
-                mval = Pval->GetMass();
-#else
-                mval = opt.MassValue;
-#endif
-                pdata[i].M_interloper+=mval;
-            }
         }
-#endif
 
+        if (imorphkernel && numingroup[i]>=opt.morphologyminsize) {
 #ifdef NOMASS
         GetGlobalSpatialMorphology(numingroup[i], &Part[noffset[i]], pdata[i].gq, pdata[i].gs, 1e-2, pdata[i].geigvec,0);
         if (RV_num>=PROPMORPHMINNUM) GetGlobalSpatialMorphology(RV_num, &Part[noffset[i]], pdata[i].RV_q, pdata[i].RV_s, 1e-2, pdata[i].RV_eigvec,0);
@@ -2111,6 +2269,7 @@ private(j,Pval,x,y,z,vx,vy,vz,jval,jzval,zdist,Rdist)
         GetGlobalSpatialMorphology(numingroup[i], &Part[noffset[i]], pdata[i].gq, pdata[i].gs, 1e-2, pdata[i].geigvec,1);
         if (RV_num>=PROPMORPHMINNUM) GetGlobalSpatialMorphology(RV_num, &Part[noffset[i]], pdata[i].RV_q, pdata[i].RV_s, 1e-2, pdata[i].RV_eigvec,1);
 #endif
+        }
     }
 
     //large groups aperture calculation
@@ -2121,7 +2280,7 @@ private(i)
 {
     #pragma omp for schedule(dynamic) nowait
 #endif
-        for (i=1;i<=ngroup;i++) if (numingroup[i]>=omppropnum)
+        for (i=1;i<=ngroup;i++) if (numingroup[i]>=omppropnum && numingroup[i]>=opt.apertureminsize)
         {
             CalculateApertureQuantities(opt, numingroup[i], &Part[noffset[i]], pdata[i]);
         }
@@ -2130,6 +2289,9 @@ private(i)
 #endif
     }
 
+    //mark the properties skipped for each object
+    for (i=1;i<=ngroup;i++) SetUnsetProperties(opt, pdata[i], numingroup[i]);
+
     //if calculating profiles
     if (opt.iprofilecalc) {
 #ifdef USEOPENMP
@@ -2141,14 +2303,9 @@ private(i,j,k,Pval,x,y,z)
     for (i=1;i<=ngroup;i++) if (numingroup[i]>=omppropnum)
     {
         double irnorm;
-        //as particles are radially sorted, init the radial bin at zero
-        int ibin=0;
         if (opt.iprofilenorm == PROFILERNORMR200CRIT) irnorm = 1.0/pdata[i].gR200c;
         else irnorm = 1.0;
-        for (j=0;j<numingroup[i];j++) {
-            Pval = &Part[noffset[i] + j];
-            AddParticleToRadialBin(opt, Pval, irnorm, ibin, pdata[i]);
-        }
+        AddParticlesToRadialBins(opt, numingroup[i], &Part[noffset[i]], irnorm, pdata[i]);
     }
 #ifdef USEOPENMP
 }
@@ -2479,7 +2636,7 @@ private(i,j,k,Pval,ri,rcmv,ri2,r2,cmx,cmy,cmz,EncMass,Ninside,icmv,cmold,x,y,z,v
             }
         }
         //sort by radius
-        gsl_heapsort(&Part[noffset[i]], numingroup[i], sizeof(Particle), RadCompare);
+        SortParticlesByRadius(numingroup[i], &Part[noffset[i]]);
         pdata[i].gsize=Part[noffset[i]+numingroup[i]-1].Radius();
         pdata[i].gRhalfmass=Part[noffset[i]+(numingroup[i]/2)].Radius();
         //then get cmvel if extra output is desired as will need angular momentum
@@ -2595,7 +2752,7 @@ private(j,Pval,x,y,z,massval)
                 Pval->SetPosition(k,(*Pval).GetPosition(k)-pdata[i].gcm[k]);
             }
         }
-        qsort(&Part[noffset[i]], numingroup[i], sizeof(Particle), RadCompare);
+        SortParticlesByRadius(numingroup[i], &Part[noffset[i]]);
         pdata[i].gsize=Part[noffset[i]+numingroup[i]-1].Radius();
         pdata[i].gRhalfmass=Part[noffset[i]+(numingroup[i]/2)].Radius();
         //then get cmvel if extra output is desired as will need angular momentum
@@ -2715,14 +2872,9 @@ private(massval,EncMass,Ninside,rc)
         for (i=1;i<=ngroup;i++)
         {
             double irnorm;
-            //as particles are radially sorted, init the radial bin at zero
-            int ibin =0;
             if (opt.iprofilenorm == PROFILERNORMR200CRIT) irnorm = 1.0/pdata[i].gR200c;
             else irnorm = 1.0;
-            for (j=0;j<numingroup[i];j++) {
-                Pval = &Part[noffset[i] + j];
-                AddParticleToRadialBin(opt,Pval,irnorm,ibin,pdata[i]);
-            }
+            AddParticlesToRadialBins(opt, numingroup[i], &Part[noffset[i]], irnorm, pdata[i]);
             pdata[i].CopyProfileToInclusive(opt);
         }
 #ifdef USEOPENMP
@@ -3720,30 +3872,18 @@ private(i,j,k,taggedparts,radii,masses,indices,posref,posparts,velparts,typepart
         //if calculating profiles
         if (opt.iprofilecalc) {
             double irnorm;
-            //as particles are radially sorted, init the radial bin at zero
-            int ibin = 0;
             if (opt.iprofilenorm == PROFILERNORMR200CRIT) irnorm = 1.0/pdata[i].gR200c;
             else irnorm = 1.0;
-            for (j=0;j<radii.size();j++) {
-                ///\todo need to update to allow for star forming/non-star forming profiles
-                ///by storing the star forming value.
-                double sfrval = 0;
-                int typeval = DARKTYPE;
 #if defined(GASON) || defined(STARON) || defined(BHON)
-                if (opt.iextragasoutput || opt.iextrastaroutput || opt.iextrainterloperoutput || opt.iSphericalOverdensityPartList)
-                    typeval = typeparts[indices[j]];
+            int *types = NULL;
+            if (opt.iextragasoutput || opt.iextrastaroutput || opt.iextrainterloperoutput || opt.iSphericalOverdensityPartList)
+                types = typeparts.data();
 #endif
-#ifndef NOMASS
-                auto massval = masses[indices[j]];
-#else
-                auto massval = opt.MassValue;
-#endif
-                AddDataToRadialBinInclusive(opt, radii[indices[j]], massval,
+            AddDataToRadialBinsInclusive(opt, radii, masses,
 #if defined(GASON) || defined(STARON) || defined(BHON)
-                    sfrval, typeval,
+                types,
 #endif
-                    irnorm, ibin, pdata[i]);
-            }
+                indices, irnorm, pdata[i]);
         }
 
 
@@ -3798,16 +3938,27 @@ private(i,j,k,taggedparts,radii,masses,indices,posref,posparts,velparts,typepart
 
 ///\name Routines to calculate specific property of a set of particles
 //@{
-///Get spatial morphology using iterative procedure
+///Get spatial morphology using iterative procedure. The positions of the particles of interest and their weights
+///are gathered once into separate coordinate arrays, which are rotated between iterations rather than the particles
 void GetGlobalSpatialMorphology(const Int_t nbodies, Particle *p, Double_t& q, Double_t& s, Double_t Error, Matrix& eigenvec, int imflag, int itype, int iiterate)
 {
     // Calculate the axial ratios q and s.
     int MAXIT=10;
     Double_t oldq,olds;
     Coordinate e;
-    Matrix R(0.),M(0.0),eigenvecp(0.);
+    Matrix M(0.0),eigenvecp(0.);
+    vector<Double_t> x, y, z, w;
+    Int_t n=0;
     eigenvec=Matrix(0.);
     eigenvec(0,0)=eigenvec(1,1)=eigenvec(2,2)=1.0;
+    x.reserve(nbodies);y.reserve(nbodies);z.reserve(nbodies);w.reserve(nbodies);
+    for (Int_t j=0;j<nbodies;j++) {
+        if (itype!=-1 && p[j].GetType()!=itype) continue;
+        x.push_back(p[j].X());y.push_back(p[j].Y());z.push_back(p[j].Z());
+        if (imflag==1) w.push_back(p[j].GetMass());
+        else w.push_back(1.0);
+    }
+    n=x.size();
     // Iterative procedure.  See Dubinski and Carlberg (1991).
     int i=0;
     if (iiterate) {
@@ -3815,23 +3966,18 @@ void GetGlobalSpatialMorphology(const Int_t nbodies, Particle *p, Double_t& q, D
     {
         M = Matrix(0.0);
         eigenvecp=Matrix(0.);
-        if (imflag==1)CalcMTensorWithMass(M, q, s, nbodies, p,itype);
-        else CalcMTensor(M, q, s, nbodies, p,itype);
+        CalcMTensor(M, q, s, n, x.data(), y.data(), z.data(), w.data());
         e = M.Eigenvalues();
         oldq = q;olds = s;
         q = sqrt(e[1] / e[0]);s = sqrt(e[2] / e[0]);
         eigenvecp=M.Eigenvectors(e);
         eigenvec=eigenvecp*eigenvec;
-        RotParticles(nbodies, p, eigenvecp);
+        RotCoordinates(n, x.data(), y.data(), z.data(), eigenvecp);
         i++;
     } while ((fabs(olds - s) > Error || fabs(oldq - q) > Error) && i<MAXIT);
-    //rotate system back to original coordinate frame
-    R=eigenvec.Transpose();
-    RotParticles(nbodies, p, R);
     }
     else {
-        if (imflag==1)CalcMTensorWithMass(M, q, s, nbodies, p,itype);
-        else CalcMTensor(M, q, s, nbodies, p,itype);
+        CalcMTensor(M, q, s, n, x.data(), y.data(), z.data(), w.data());
         e = M.Eigenvalues();
         oldq = q;olds = s;
         q = sqrt(e[1] / e[0]);s = sqrt(e[2] / e[0]);
@@ -4127,178 +4273,73 @@ private(i,weight)
     I=I*(1.0/mtot);
 }
 
-///calculate the weighted reduced inertia tensor assuming particles are the same mass
-void CalcMTensor(Matrix& M, const Double_t q, const Double_t s, const Int_t n, Particle *p, int itype)
+///calculate the weighted reduced inertia tensor of a set of coordinates, each with its own weight (unity or mass)
+void CalcMTensor(Matrix& M, const Double_t q, const Double_t s, const Int_t n, const Double_t *x, const Double_t *y, const Double_t *z, const Double_t *w)
 {
     Int_t i;
-    int j,k;
-    Double_t a2,Mxx,Myy,Mzz,Mxy,Mxz,Myz,weight;
+    Double_t a2,Mxx,Myy,Mzz,Mxy,Mxz,Myz;
     Mxx=Myy=Mzz=Mxy=Mxz=Myz=0.;
 #ifdef USEOPENMP
-    if (n>=ompunbindnum) {
-#pragma omp parallel default(shared) \
-private(i,a2,weight)
-{
-#pragma omp for schedule(dynamic) nowait reduction(+:Mxx,Myy,Mzz,Mxy,Mxz,Myz)
+#pragma omp parallel for \
+default(shared) private(i,a2) schedule(static) \
+reduction(+:Mxx,Myy,Mzz,Mxy,Mxz,Myz) if (n>=ompunbindnum)
+#endif
     for (i = 0; i < n; i++)
     {
-        a2 = (p[i].X()*p[i].X()+p[i].Y()*p[i].Y()/q/q+p[i].Z()*p[i].Z()/s/s);
+        a2 = (x[i]*x[i]+y[i]*y[i]/q/q+z[i]*z[i]/s/s);
         if (a2!=0) {
-        if (itype==-1) weight=1.0;
-        else if (p[i].GetType()==itype) weight=1.0;
-        else weight=0.;
-        a2=1.0/a2*weight;
-        Mxx+=p[i].X()*p[i].X()*a2;
-        Myy+=p[i].Y()*p[i].Y()*a2;
-        Mzz+=p[i].Z()*p[i].Z()*a2;
-        Mxy+=p[i].X()*p[i].Y()*a2;
-        Mxz+=p[i].X()*p[i].Z()*a2;
-        Myz+=p[i].Y()*p[i].Z()*a2;
+            a2=w[i]/a2;
+            Mxx+=x[i]*x[i]*a2;
+            Myy+=y[i]*y[i]*a2;
+            Mzz+=z[i]*z[i]*a2;
+            Mxy+=x[i]*y[i]*a2;
+            Mxz+=x[i]*z[i]*a2;
+            Myz+=y[i]*z[i]*a2;
         }
     }
-}
     M(0,0)=Mxx;M(1,1)=Myy;M(2,2)=Mzz;
     M(0,1)=M(1,0)=Mxy;
     M(0,2)=M(2,0)=Mxz;
     M(1,2)=M(2,1)=Myz;
-    }
-    else {
+}
+
+///rotate a set of coordinates
+void RotCoordinates(const Int_t n, Double_t *x, Double_t *y, Double_t *z, Matrix &R)
+{
+    Int_t i;
+    Double_t tx,ty,tz;
+#ifdef USEOPENMP
+#pragma omp parallel for \
+default(shared) private(i,tx,ty,tz) schedule(static) if (n>=ompunbindnum)
 #endif
-    for (i = 0; i < n; i++)
+    for (i=0; i<n; i++)
     {
-        a2 = (p[i].X()*p[i].X()+p[i].Y()*p[i].Y()/q/q+p[i].Z()*p[i].Z()/s/s);
-        if(a2!=0){
-            if (itype==-1) weight=1.0;
-            else if (p[i].GetType()==itype) weight=1.0;
-            else weight=0.;
-            a2=1.0/a2*weight;
-            for (j = 0; j < 3; j++)
-                for (k = 0; k < 3; k++)
-                M(j, k) += p[i].GetPosition(j)*p[i].GetPosition(k)*a2;
-        }
-    }
-#ifdef USEOPENMP
+        tx=R(0,0)*x[i]+R(0,1)*y[i]+R(0,2)*z[i];
+        ty=R(1,0)*x[i]+R(1,1)*y[i]+R(1,2)*z[i];
+        tz=R(2,0)*x[i]+R(2,1)*y[i]+R(2,2)*z[i];
+        x[i]=tx;y[i]=ty;z[i]=tz;
     }
-#endif
 }
 
-///calculate the weighted reduced inertia tensor
-void CalcMTensorWithMass(Matrix& M, const Double_t q, const Double_t s, const Int_t n, Particle *p, int itype)
+///calculate the phase-space dispersion tensor
+GMatrix CalcPhaseCM(const Int_t n, Particle *p, int itype)
 {
+    Double_t det,weight;
+    Double_t cmx,cmy,cmz,cmvx,cmvy,cmvz;
+    GMatrix cm(6,1);
     Int_t i;
-    int j,k;
-    Double_t a2,Mxx,Myy,Mzz,Mxy,Mxz,Myz,weight;
-    Mxx=Myy=Mzz=Mxy=Mxz=Myz=0.;
+    cmx=cmy=cmz=cmvx=cmvy=cmvz=0;
+    Double_t mtot=0;
 #ifdef USEOPENMP
     if (n>=ompunbindnum) {
 #pragma omp parallel default(shared) \
-private(i,a2,weight)
+private(i,weight)
 {
-#pragma omp for schedule(dynamic) nowait reduction(+:Mxx,Myy,Mzz,Mxy,Mxz,Myz)
+#pragma omp for schedule(dynamic) reduction(+:cmx,cmy,cmz,cmvx,cmvy,cmvz,mtot)
     for (i = 0; i < n; i++)
     {
-        a2 = (p[i].X()*p[i].X()+p[i].Y()*p[i].Y()/q/q+p[i].Z()*p[i].Z()/s/s);
-        if (a2!=0) {
-        if (itype==-1) weight=1.0;
-        else if (p[i].GetType()==itype) weight=1.0;
-        else weight=0.;
-        a2=p[i].GetMass()/a2*weight;
-        Mxx+=p[i].X()*p[i].X()*a2;
-        Myy+=p[i].Y()*p[i].Y()*a2;
-        Mzz+=p[i].Z()*p[i].Z()*a2;
-        Mxy+=p[i].X()*p[i].Y()*a2;
-        Mxz+=p[i].X()*p[i].Z()*a2;
-        Myz+=p[i].Y()*p[i].Z()*a2;
-        }
-    }
-}
-    M(0,0)=Mxx;M(1,1)=Myy;M(2,2)=Mzz;
-    M(0,1)=M(1,0)=Mxy;
-    M(0,2)=M(2,0)=Mxz;
-    M(1,2)=M(2,1)=Myz;
-    }
-    else {
-#endif
-    for (i = 0; i < n; i++)
-    {
-        a2 = (p[i].X()*p[i].X()+p[i].Y()*p[i].Y()/q/q+p[i].Z()*p[i].Z()/s/s);
-        if(a2!=0){
-        if (itype==-1) weight=1.0;
-        else if (p[i].GetType()==itype) weight=1.0;
-        else weight=0.;
-            a2=p[i].GetMass()/a2*weight;
-            for (j = 0; j < 3; j++)
-                for (k = 0; k < 3; k++)
-                M(j, k) += p[i].GetPosition(j)*p[i].GetPosition(k)*a2;
-        }
-    }
-#ifdef USEOPENMP
-    }
-#endif
-}
-
-///rotate particles
-void RotParticles(const Int_t n, Particle *p, Matrix &R)
-{
-    Int_t i;
-    int j;
-    Coordinate temp;
-#ifdef USEOPENMP
-    if (n>=ompunbindnum) {
-#pragma omp parallel default(shared) \
-private(i,j,temp)
-{
-#pragma omp for schedule(dynamic) nowait
-    for (i=0; i<n; i++)
-    {
-        temp[0]=temp[1]=temp[2]=0.;
-        for (j=0; j<3; j++)
-        {
-            temp[0] += R(0, j) * (p[i].GetPosition(j));
-            temp[1] += R(1, j) * (p[i].GetPosition(j));
-            temp[2] += R(2, j) * (p[i].GetPosition(j));
-        }
-        p[i].SetPosition(temp[0], temp[1], temp[2]);
-    }
-}
-    }
-    else {
-#endif
-    for (i=0; i<n; i++)
-    {
-        temp[0]=temp[1]=temp[2]=0.;
-        for (j=0; j<3; j++)
-        {
-            temp[0] += R(0, j) * (p[i].GetPosition(j));
-            temp[1] += R(1, j) * (p[i].GetPosition(j));
-            temp[2] += R(2, j) * (p[i].GetPosition(j));
-        }
-        p[i].SetPosition(temp[0], temp[1], temp[2]);
-    }
-#ifdef USEOPENMP
-    }
-#endif
-}
-
-///calculate the phase-space dispersion tensor
-GMatrix CalcPhaseCM(const Int_t n, Particle *p, int itype)
-{
-    Double_t det,weight;
-    Double_t cmx,cmy,cmz,cmvx,cmvy,cmvz;
-    GMatrix cm(6,1);
-    Int_t i;
-    cmx=cmy=cmz=cmvx=cmvy=cmvz=0;
-    Double_t mtot=0;
-#ifdef USEOPENMP
-    if (n>=ompunbindnum) {
-#pragma omp parallel default(shared) \
-private(i,weight)
-{
-#pragma omp for schedule(dynamic) reduction(+:cmx,cmy,cmz,cmvx,cmvy,cmvz,mtot)
-    for (i = 0; i < n; i++)
-    {
-        if (itype==-1) weight=p[i].GetMass();
-        else if (p[i].GetType()==itype) weight=p[i].GetMass();
+        if (itype==-1) weight=p[i].GetMass();
+        else if (p[i].GetType()==itype) weight=p[i].GetMass();
         else weight=0.;
         cmx+=p[i].X()*weight;
         cmy+=p[i].Y()*weight;
@@ -4344,68 +4385,107 @@ void CalcConcentration(PropData &p)
     p.cNFWBN98 = CalcConcentrationRootFindingRhalf(p.gRhalfBN98/p.gRBN98, tol);
 }
 
+///NFW enclosed mass profile shape, ln(1+x)-x/(1+x)
+inline double NFWMassShape(double x)
+{
+    return log(1.0+x)-x/(1.0+x);
+}
+
+///ratio of the half mass radius to the outer radius of an NFW halo of concentration c, found by bisection
+double NFWRhalfRatio(double c)
+{
+    double halfmass=0.5*NFWMassShape(c), rlo=0, rhi=1.0, r;
+    for (int iter=0;iter<64;iter++) {
+        r=0.5*(rlo+rhi);
+        if (NFWMassShape(c*r)<halfmass) rlo=r;
+        else rhi=r;
+    }
+    return 0.5*(rlo+rhi);
+}
+
+///logarithmically spaced concentrations at which the NFW relations are tabulated
+vector<double> NFWConcentrationTableGrid(double cmin, double cmax)
+{
+    vector<double> logc(NFWCONCENTRATIONTABLESIZE);
+    double logcmin=log(cmin), logcmax=log(cmax);
+    for (int i=0;i<NFWCONCENTRATIONTABLESIZE;i++) logc[i]=logcmin+(logcmax-logcmin)*i/(double)(NFWCONCENTRATIONTABLESIZE-1);
+    return logc;
+}
+
+///find the concentration corresponding to value from a relation tabulated at logarithmically spaced concentrations,
+///by bisecting the table and interpolating linearly in log c. The relation must be monotonic along the table
+///(either increasing or decreasing); values beyond the table return the end points.
+double NFWConcentrationFromTable(const vector<double> &logc, const vector<double> &table, double value)
+{
+    int n=table.size(), ilo=0, ihi=n-1, imid;
+    bool increasing=(table[n-1]>table[0]);
+    if (increasing ? value<=table[0] : value>=table[0]) return exp(logc[0]);
+    if (increasing ? value>=table[n-1] : value<=table[n-1]) return exp(logc[n-1]);
+    while (ihi-ilo>1) {
+        imid=(ilo+ihi)/2;
+        if ((table[imid]<value)==increasing) ilo=imid;
+        else ihi=imid;
+    }
+    return exp(logc[ilo]+(logc[ihi]-logc[ilo])*(value-table[ilo])/(table[ihi]-table[ilo]));
+}
+
+///Solve for concentration given the ratio of the half mass radius to the outer radius of the halo. The relation
+///is tabulated once for c in [0.6,10000] and inverted by interpolation, followed by a few Newton steps so that the
+///concentration is accurate to well below tol.
 double CalcConcentrationRootFindingRhalf(double rratio, double tol)
 {
     if (rratio >= NFWMAXRHALFRATIO) return -1.0;
     else if (rratio <= NFWMINRHALFRATIO) return -1.0;
-    int status;
-    int iter = 0, max_iter = 100;
-    const gsl_root_fsolver_type *T;
-    gsl_root_fsolver *s;
-    double cval = 2.3;
-    //start point for concentration
-    double x_lo = 0.6, x_hi = 10000.0;
-    gsl_function F;
-    F.function = &mycNFWRhalf;
-    F.params = &rratio;
-    T = gsl_root_fsolver_brent;
-    s = gsl_root_fsolver_alloc (T);
-    //gsl_invoke(gsl_root_fsolver_set, s, &F, x_lo, x_hi);
-    gsl_root_fsolver_set (s, &F, x_lo, x_hi);
-    do
-    {
-        iter++;
-        status = gsl_root_fsolver_iterate (s);
-        //gsl_invoke(gsl_root_fsolver_iterate, s);
-        cval = gsl_root_fsolver_root (s);
-        x_lo = gsl_root_fsolver_x_lower (s);
-        x_hi = gsl_root_fsolver_x_upper (s);
-        status = gsl_root_test_interval (x_lo, x_hi, tol, tol);
-    }
-    while (status == GSL_CONTINUE && iter < max_iter);
-    gsl_root_fsolver_free (s);
+    else if (std::isnan(rratio)) return -1.0;
+    static const vector<double> logc=NFWConcentrationTableGrid(0.6, 10000.0);
+    static const vector<double> table=[]() {
+        vector<double> t(logc.size());
+        for (auto i=0;i<logc.size();i++) t[i]=NFWRhalfRatio(exp(logc[i]));
+        return t;
+    }();
+    double cval=NFWConcentrationFromTable(logc, table, rratio), a, f, df, dc;
+    for (int iter=0;iter<NFWCONCENTRATIONNEWTONMAXITER;iter++) {
+        //f = F(c*rratio)-0.5F(c) where F'(x)=x/(1+x)^2
+        a=cval*rratio;
+        f=NFWMassShape(a)-0.5*NFWMassShape(cval);
+        df=rratio*a/((1.0+a)*(1.0+a))-0.5*cval/((1.0+cval)*(1.0+cval));
+        if (df==0) break;
+        dc=-f/df;
+        if (cval+dc<=0) break;
+        cval+=dc;
+        if (fabs(dc)<=1e-3*tol*cval) break;
+    }
     return cval;
 }
 
+///Solve for concentration given (Vmax/Vvir)^2 = 0.216c/F(c) (Prada et al. 2012), which increases monotonically with c
+///beyond c~2.163 where Vmax=Vvir. The relation is tabulated once for c up to 5000 and inverted by interpolation,
+///followed by a few Newton steps so that the concentration is accurate to well below tol. Ratios at or below the
+///minimum of the relation (about 1) return -1, as do out of range ratios in \ref CalcConcentrationRootFindingRhalf.
 double CalcConcentrationRootFindingVmax(double VmaxVvir2, double tol)
 {
     if (VmaxVvir2 >= NFWMINVMAXVVIRRATIO) return -1;
-    int status;
-    int iter = 0, max_iter = 100;
-    const gsl_root_fsolver_type *T;
-    gsl_root_fsolver *s;
-    double cval = 2.3;
-    //start point for concentration
-    double x_lo = 1.9, x_hi = 5000.0;
-    gsl_function F;
-    F.function = &mycNFW;
-    F.params = &VmaxVvir2;
-    T = gsl_root_fsolver_brent;
-    s = gsl_root_fsolver_alloc (T);
-    //gsl_invoke(gsl_root_fsolver_set, s, &F, x_lo, x_hi);
-    gsl_root_fsolver_set (s, &F, x_lo, x_hi);
-    do
-    {
-        iter++;
-        status = gsl_root_fsolver_iterate (s);
-        //gsl_invoke(gsl_root_fsolver_iterate, s);
-        cval = gsl_root_fsolver_root (s);
-        x_lo = gsl_root_fsolver_x_lower (s);
-        x_hi = gsl_root_fsolver_x_upper (s);
-        status = gsl_root_test_interval (x_lo, x_hi, tol, tol);
-    }
-    while (status == GSL_CONTINUE && iter < max_iter);
-    gsl_root_fsolver_free (s);
+    else if (std::isnan(VmaxVvir2)) return -1;
+    static const vector<double> logc=NFWConcentrationTableGrid(2.163, 5000.0);
+    static const vector<double> table=[]() {
+        vector<double> t(logc.size());
+        for (auto i=0;i<logc.size();i++) t[i]=0.216*exp(logc[i])/NFWMassShape(exp(logc[i]));
+        return t;
+    }();
+    //values at or below the minimum of the relation have no NFW solution
+    if (VmaxVvir2 <= table[0]) return -1;
+    double cval=NFWConcentrationFromTable(logc, table, VmaxVvir2), fc, f, df, dc;
+    for (int iter=0;iter<NFWCONCENTRATIONNEWTONMAXITER;iter++) {
+        //f = 0.216c/F(c)-VmaxVvir2 where F'(c)=c/(1+c)^2
+        fc=NFWMassShape(cval);
+        f=0.216*cval/fc-VmaxVvir2;
+        df=0.216*(fc-cval*cval/((1.0+cval)*(1.0+cval)))/(fc*fc);
+        if (df<=0) break;
+        dc=-f/df;
+        if (cval+dc<=0) break;
+        cval+=dc;
+        if (fabs(dc)<=1e-3*tol*cval) break;
+    }
     return cval;
 }
 
@@ -4584,16 +4664,15 @@ void CopyMasses(Options &opt, const Int_t nhalos, PropData *&pold, PropData *&pn
 ///reorder mass information stored in properties data
 void ReorderInclusiveMasses(const Int_t &numgroups, const Int_t &newnumgroups, Int_t *&numingroup, PropData *&pdata)
 {
-    PropData *pnew=new PropData[newnumgroups+1];
+    Int_t *order=new Int_t[numgroups+1];
     PriorityQueue *pq=new PriorityQueue(newnumgroups);
     for (Int_t i = 1; i <=numgroups; i++) if (numingroup[i]>0) pq->Push(i, numingroup[i]);
     for (Int_t i = 1; i<=newnumgroups; i++) {
-        Int_t groupid=pq->TopQueue(),size=pq->TopPriority();pq->Pop();
-        pnew[i]=pdata[groupid];
+        order[i]=pq->TopQueue();pq->Pop();
     }
     delete pq;
-    for (Int_t i = 1; i<=newnumgroups; i++) pdata[i]=pnew[i];
-    delete[] pnew;
+    ReorderPropData(numgroups, newnumgroups, order, pdata);
+    delete[] order;
 }
 //@}
 
@@ -4766,7 +4845,7 @@ private(i,j,k,r2,v2,poti,Ti,pot,Eval,npot,storepid,menc,potmin,ipotmin,cmpotmin)
             for (j=0;j<numingroup[i];j++) {
                 for (k=0;k<3;k++) Part[j+noffset[i]].SetPosition(k,Part[j+noffset[i]].GetPosition(k)-cmpotmin[k]);
             }
-            gsl_heapsort(&Part[noffset[i]],numingroup[i],sizeof(Particle),RadCompare);
+            SortParticlesByRadius(numingroup[i], &Part[noffset[i]]);
             //now determine kinetic frame
             pdata[i].gcmvel[0]=pdata[i].gcmvel[1]=pdata[i].gcmvel[2]=menc=0.;
             for (j=0;j<npot;j++) {
@@ -4850,7 +4929,7 @@ private(i,j,k,r2,v2,poti,Ti,pot,Eval,npot,storepid,menc,potmin,ipotmin,cmpotmin)
             for (j=0;j<numingroup[i];j++) {
                 for (k=0;k<3;k++) Part[j+noffset[i]].SetPosition(k,Part[j+noffset[i]].GetPosition(k)-cmpotmin[k]);
             }
-            gsl_heapsort(&Part[noffset[i]],numingroup[i],sizeof(Particle),RadCompare);
+            SortParticlesByRadius(numingroup[i], &Part[noffset[i]]);
             //now determine kinetic frame
             pdata[i].gcmvel[0]=pdata[i].gcmvel[1]=pdata[i].gcmvel[2]=menc=0.;
             for (j=0;j<npot;j++) {
@@ -5255,38 +5334,6 @@ Int_t *GetParentID(Int_t ngroups)
 //@}
 
 
-///\name functions used to find root of concentration
-//@{
-double mycNFW(double c, void *params)
-{
-  double *p = (double*) params;
-  Double_t VmaxVvir2=*p;
-  return (VmaxVvir2) -0.216*c/(log(1.0+c)-c/(1.0+c));
-}
-double mycNFW_deriv(double c, void *params)
-{
-  double *p = (double*) params;
-  Double_t VvirVmax2=*p;
-  return 0.216*c/pow((1.0+c),2.0);
-}
-void mycNFW_fdf(double c, void *params, double *y, double *dy)
-{
-  double *p = (double*) params;
-  Double_t VmaxVvir2=*p;
-  Double_t conec=c/(1.0+c);
-  *y=(VmaxVvir2)-0.216*c/(log(1.0+c)-conec);
-  *dy=0.216*conec*conec/c;
-}
-
-double mycNFWRhalf(double c, void *params)
-{
-  double *p = (double*) params;
-  Double_t RhalfRvir=*p;
-  Double_t a = c*RhalfRvir;
-  return (log(1.0+a)-a/(1.0+a))-0.5*(log(1.0+c)-c/(1.0+c));
-}
-//@}
-
 ///\name Simple cosmology related functions
 //@{
 void CalcOmegak(Options &opt) {
@@ -5363,6 +5410,29 @@ Double_t GetApertureRadiusInterpolation(const Double_t &oldrc, const Double_t &r
     return (EncMass-refmass)*(rc-oldrc)/(mass)+oldrc;
 }
 
+/*! Enclosed mass profile of one class of particles, built while sweeping through radially sorted particles.
+    Since the enclosed mass is monotonic, the radius enclosing half of an aperture mass is found by a
+    binary search rather than by checking every aperture for every particle.
+*/
+struct ApertureMassProfile {
+    vector<Double_t> rc, mass, encmass;
+    void Reset() {rc.clear(); mass.clear(); encmass.clear();}
+    void Add(Double_t r, Double_t m) {
+        rc.push_back(r);
+        mass.push_back(m);
+        encmass.push_back((encmass.size()>0?encmass.back():0)+m);
+    }
+    ///radius enclosing half of the aperture mass, interpolated between the particle that crosses it and the previous one of this class
+    Double_t HalfMassRadius(Double_t aperturemass) const {
+        Double_t refmass=0.5*aperturemass;
+        if (refmass<=0) return 0;
+        auto it=lower_bound(encmass.begin(), encmass.end(), refmass);
+        if (it==encmass.end()) return -1;
+        auto i=it-encmass.begin();
+        return GetApertureRadiusInterpolation((i>0?rc[i-1]:0), rc[i], encmass[i], mass[i], refmass);
+    }
+};
+
 
 /// \name Aperture related quantities
 //@{
@@ -5475,9 +5545,19 @@ void CalculateApertureQuantities(Options &opt, Int_t &ning, Particle *Part, Prop
     Double_t EncVRDisp=0, EncVRDispGas=0, EncVRDispGasSF=0, EncVRDispGasNSF=0, EncVRDispStar=0, EncVRDispBH=0, EncVRDispInterloper=0;
     Double_t EncSFR=0, EncZmetGas=0, EncZmetGasSF=0, EncZmetGasNSF=0, EncZmetStar=0;
     Double_t EncMassGasHot=0, EncTGasHot=0, EncZGasHot=0;
-    int iaptindex=0, numapttotal, type;
-    Double_t mass, rc, oldrc, veldisp, vrdisp, SFR, Zmet, temp;
-    Double_t oldrc_gas,oldrc_gas_sf,oldrc_gas_nsf,oldrc_star,oldrc_bh;
+    int iaptindex=0, type;
+    Double_t mass, rc, veldisp, vrdisp, SFR, Zmet, temp;
+    //enclosed mass profiles of the particles inside the apertures, used to get half mass radii
+    ApertureMassProfile encprof;
+#ifdef GASON
+    ApertureMassProfile encprof_gas;
+#ifdef STARON
+    ApertureMassProfile encprof_gas_sf, encprof_gas_nsf;
+#endif
+#endif
+#ifdef STARON
+    ApertureMassProfile encprof_star;
+#endif
     Particle *Pval;
     Coordinate x2;
 
@@ -5643,6 +5723,7 @@ void CalculateApertureQuantities(Options &opt, Int_t &ning, Particle *Part, Prop
         }
         if (iaptindex==opt.aperturenum) break;
         EncMass+=mass;
+        encprof.Add(rc, mass);
         Ninside++;
         if (type == DARKTYPE) NinsideDM++;
         EncVelDisp += veldisp;
@@ -5651,6 +5732,7 @@ void CalculateApertureQuantities(Options &opt, Int_t &ning, Particle *Part, Prop
         if (type==GASTYPE) {
             NinsideGas++;
             EncMassGas+=mass;
+            encprof_gas.Add(rc, mass);
             EncVelDispGas += veldisp;
             EncVRDispGas += vrdisp;
 #ifdef STARON
@@ -5659,6 +5741,7 @@ void CalculateApertureQuantities(Options &opt, Int_t &ning, Particle *Part, Prop
             if (SFR>opt.gas_sfr_threshold) {
                 NinsideGasSF++;
                 EncMassGasSF+=mass;
+                encprof_gas_sf.Add(rc, mass);
                 EncVelDispGasSF += veldisp;
                 EncVRDispGasSF += vrdisp;
                 EncZmetGasSF += Zmet;
@@ -5666,6 +5749,7 @@ void CalculateApertureQuantities(Options &opt, Int_t &ning, Particle *Part, Prop
             else {
                 NinsideGasNSF++;
                 EncMassGasNSF += mass;
+                encprof_gas_nsf.Add(rc, mass);
                 EncVelDispGasNSF += veldisp;
                 EncVRDispGasNSF += vrdisp;
                 EncZmetGasNSF += Zmet;
@@ -5693,6 +5777,7 @@ void CalculateApertureQuantities(Options &opt, Int_t &ning, Particle *Part, Prop
         if (type==STARTYPE) {
             NinsideStar++;
             EncMassStar += mass;
+            encprof_star.Add(rc, mass);
             EncVelDispStar += veldisp;
             EncVRDispStar += vrdisp;
             EncZmetStar += Zmet;
@@ -5830,96 +5915,18 @@ void CalculateApertureQuantities(Options &opt, Int_t &ning, Particle *Part, Prop
 #endif
     }
 
-    //then determine half mass radii for 3d apertures
-    EncMass=EncMassGas=EncMassGasSF=EncMassGasNSF=EncMassStar=EncMassBH=EncMassInterloper=0;
-    numapttotal=0;
-    numapttotal+=opt.aperturenum;
-#ifdef GASON
-    numapttotal+=opt.aperturenum;
-#ifdef STARON
-    numapttotal+=opt.aperturenum;
-    numapttotal+=opt.aperturenum;
-#endif
-#endif
-#ifdef STARON
-    numapttotal+=opt.aperturenum;
-#endif
-    iaptindex=0;
-    oldrc=oldrc_gas=oldrc_gas_sf=oldrc_gas_nsf=oldrc_star=oldrc_bh=0;
-    for (auto j=0;j<ning;j++) {
-        Pval=&Part[j];
-        rc=Pval->Radius();
-#ifndef NOMASS
-        mass = Pval->GetMass();
-#else
-        mass = opt.MassValue;
-#endif
-        type = Pval->GetType();
-        EncMass+=mass;
-#ifdef GASON
-        if (type==GASTYPE) {
-            EncMassGas+=mass;
-#ifdef STARON
-            if (SFR>opt.gas_sfr_threshold) EncMassGasSF+=mass;
-            else EncMassGasNSF+=mass;
-#endif
-        }
-#endif
-#ifdef STARON
-        if (type==STARTYPE) EncMassStar+=mass;
-#endif
-#ifdef BHON
-        if (type==BHTYPE) EncMassBH+=mass;
-#endif
-        for (auto k=0;k<opt.aperturenum;k++) {
-            if (EncMass>=0.5*pdata.aperture_mass[k] && pdata.aperture_rhalfmass[k]==-1)
-            {
-                pdata.aperture_rhalfmass[k]=GetApertureRadiusInterpolation(oldrc, rc, EncMass, mass, 0.5*pdata.aperture_mass[k]);//oldrc;
-                iaptindex++;
-            }
+    //then determine half mass radii for 3d apertures by binary search of the enclosed mass profiles
+    for (auto k=0;k<opt.aperturenum;k++) {
+        pdata.aperture_rhalfmass[k]=encprof.HalfMassRadius(pdata.aperture_mass[k]);
 #ifdef GASON
-            if (EncMassGas>=0.5*pdata.aperture_mass_gas[k] && pdata.aperture_rhalfmass_gas[k]==-1)
-            {
-                pdata.aperture_rhalfmass_gas[k]=GetApertureRadiusInterpolation(oldrc_gas, rc, EncMassGas, mass, 0.5*pdata.aperture_mass_gas[k]);//oldrc_gas;
-                iaptindex++;
-            }
+        pdata.aperture_rhalfmass_gas[k]=encprof_gas.HalfMassRadius(pdata.aperture_mass_gas[k]);
 #ifdef STARON
-            if (EncMassGasSF>=0.5*pdata.aperture_mass_gas_sf[k] && pdata.aperture_rhalfmass_gas_sf[k]==-1)
-            {
-                pdata.aperture_rhalfmass_gas_sf[k]=GetApertureRadiusInterpolation(oldrc_gas_sf, rc, EncMassGasSF, mass, 0.5*pdata.aperture_mass_gas_sf[k]);//oldrc_gas_sf;
-                iaptindex++;
-            }
-            if (EncMassGasNSF>=0.5*pdata.aperture_mass_gas_nsf[k] && pdata.aperture_rhalfmass_gas_nsf[k]==-1)
-            {
-                pdata.aperture_rhalfmass_gas_nsf[k]=GetApertureRadiusInterpolation(oldrc_gas_nsf, rc, EncMassGasNSF, mass, 0.5*pdata.aperture_mass_gas_nsf[k]);//oldrc_gas_nsf;
-                iaptindex++;
-            }
+        pdata.aperture_rhalfmass_gas_sf[k]=encprof_gas_sf.HalfMassRadius(pdata.aperture_mass_gas_sf[k]);
+        pdata.aperture_rhalfmass_gas_nsf[k]=encprof_gas_nsf.HalfMassRadius(pdata.aperture_mass_gas_nsf[k]);
 #endif
 #endif
 #ifdef STARON
-            if (EncMassStar>=0.5*pdata.aperture_mass_star[k] && pdata.aperture_rhalfmass_star[k]==-1)
-            {
-                pdata.aperture_rhalfmass_star[k]=GetApertureRadiusInterpolation(oldrc_star, rc, EncMassStar, mass, 0.5*pdata.aperture_mass_star[k]);//oldrc_star;
-                iaptindex++;
-            }
-#endif
-        }
-        if (iaptindex==numapttotal) break;
-        oldrc=rc;
-#ifdef GASON
-        if (type==GASTYPE) {
-            oldrc_gas=rc;
-#ifdef STARON
-            if (SFR>opt.gas_sfr_threshold) oldrc_gas_sf=rc;
-            else oldrc_gas_nsf=rc;
-#endif
-        }
-#endif
-#ifdef STARON
-        if (type==STARTYPE) oldrc_star=rc;
-#endif
-#ifdef BHON
-        if (type==BHTYPE) oldrc_bh=rc;
+        pdata.aperture_rhalfmass_star[k]=encprof_star.HalfMassRadius(pdata.aperture_mass_star[k]);
 #endif
     }
     //take sqrts of dispersions
@@ -5976,6 +5983,17 @@ void CalculateApertureQuantities(Options &opt, Int_t &ning, Particle *Part, Prop
         }
         iaptindex=0;
         EncMass=EncMassGas=EncMassGasSF=EncMassGasNSF=EncMassStar=EncMassBH=EncMassInterloper=0;
+        encprof.Reset();
+#ifdef GASON
+        encprof_gas.Reset();
+#ifdef STARON
+        encprof_gas_sf.Reset();
+        encprof_gas_nsf.Reset();
+#endif
+#endif
+#ifdef STARON
+        encprof_star.Reset();
+#endif
         EncSFR=EncZmetGas=EncZmetGasSF=EncZmetGasNSF=EncZmetStar=0;
         for (auto j=0;j<ning;j++) {
             rc=proj[j].rproj[k];
@@ -6006,18 +6024,22 @@ void CalculateApertureQuantities(Options &opt, Int_t &ning, Particle *Part, Prop
             }
             if (iaptindex==opt.apertureprojnum) break;
             EncMass+=mass;
+            encprof.Add(rc, mass);
 #ifdef GASON
             if (type==GASTYPE) {
                 EncMassGas+=mass;
+                encprof_gas.Add(rc, mass);
 #ifdef STARON
                 EncSFR+=SFR;
                 EncZmetGas += Zmet;
                 if (SFR>opt.gas_sfr_threshold) {
                     EncMassGasSF+=mass;
+                    encprof_gas_sf.Add(rc, mass);
                     EncZmetGasSF += Zmet;
                 }
                 else {
                     EncMassGasNSF+=mass;
+                    encprof_gas_nsf.Add(rc, mass);
                     EncZmetGasNSF += Zmet;
                 }
 #endif
@@ -6026,6 +6048,7 @@ void CalculateApertureQuantities(Options &opt, Int_t &ning, Particle *Part, Prop
 #ifdef STARON
             if (type==STARTYPE) {
                 EncMassStar+=mass;
+                encprof_star.Add(rc, mass);
                 EncZmetStar += Zmet;
             }
 #endif
@@ -6062,89 +6085,18 @@ void CalculateApertureQuantities(Options &opt, Int_t &ning, Particle *Part, Prop
             }
 #endif
         }
-        //then determine half mass radii
-        EncMass=EncMassGas=EncMassGasSF=EncMassGasNSF=EncMassStar=EncMassBH=EncMassInterloper=0;
-        numapttotal=0;
-        numapttotal+=opt.apertureprojnum;
-#ifdef GASON
-        numapttotal+=opt.apertureprojnum;
-#ifdef STARON
-        numapttotal+=opt.apertureprojnum;
-        numapttotal+=opt.apertureprojnum;
-#endif
-#endif
-#ifdef STARON
-        numapttotal+=opt.aperturenum;
-#endif
-        iaptindex=0;
-        oldrc=oldrc_gas=oldrc_gas_sf=oldrc_gas_nsf=oldrc_star=oldrc_bh=0;
-        for (auto j=0;j<ning;j++) {
-            rc=proj[j].rproj[k];
-            mass = proj[j].mass;
-            type = proj[j].type;
-#if defined(GASON) && defined(STARON)
-            SFR = proj[j].SFR;
-#endif
-            EncMass+=mass;
-#ifdef GASON
-            if (type==GASTYPE) {
-                EncMassGas+=mass;
-#ifdef STARON
-                if (SFR>opt.gas_sfr_threshold) EncMassGasSF+=mass;
-                else EncMassGasNSF+=mass;
-#endif
-            }
-#endif
-#ifdef STARON
-            if (type==STARTYPE) EncMassStar+=mass;
-#endif
-#ifdef BHON
-            if (type==BHTYPE) EncMassBH+=mass;
-#endif
-            for (auto i=0;i<opt.apertureprojnum;i++) {
-                if (EncMass>=0.5*pdata.aperture_mass_proj[i][k] && pdata.aperture_rhalfmass_proj[i][k]==-1) {
-                    pdata.aperture_rhalfmass_proj[i][k]=GetApertureRadiusInterpolation(oldrc, rc, EncMass, mass, 0.5*pdata.aperture_mass_proj[i][k]);//oldrc;
-                    iaptindex++;
-                }
+        //then determine half mass radii by binary search of the enclosed mass profiles
+        for (auto i=0;i<opt.apertureprojnum;i++) {
+            pdata.aperture_rhalfmass_proj[i][k]=encprof.HalfMassRadius(pdata.aperture_mass_proj[i][k]);
 #ifdef GASON
-                if (EncMassGas>=0.5*pdata.aperture_mass_proj_gas[k][i] && pdata.aperture_rhalfmass_proj_gas[i][k]==-1) {
-                    pdata.aperture_rhalfmass_proj_gas[i][k]=GetApertureRadiusInterpolation(oldrc_gas, rc, EncMassGas, mass, 0.5*pdata.aperture_mass_proj_gas[i][k]);//oldrc_gas;
-                    iaptindex++;
-                }
+            pdata.aperture_rhalfmass_proj_gas[i][k]=encprof_gas.HalfMassRadius(pdata.aperture_mass_proj_gas[i][k]);
 #ifdef STARON
-                if (EncMassGasSF>=0.5*pdata.aperture_mass_proj_gas_sf[i][k] && pdata.aperture_rhalfmass_proj_gas_sf[i][k]==-1) {
-                    pdata.aperture_rhalfmass_proj_gas_sf[i][k]=GetApertureRadiusInterpolation(oldrc_gas_sf, rc, EncMassGasSF, mass, 0.5*pdata.aperture_mass_proj_gas_sf[i][k]);//oldrc_gas_sf;
-                    iaptindex++;
-                }
-                if (EncMassGasNSF>=0.5*pdata.aperture_mass_proj_gas_nsf[i][k] && pdata.aperture_rhalfmass_proj_gas_nsf[i][k]==-1) {
-                    pdata.aperture_rhalfmass_proj_gas_nsf[i][k]=GetApertureRadiusInterpolation(oldrc_gas_nsf, rc, EncMassGasNSF, mass, 0.5*pdata.aperture_mass_proj_gas_nsf[i][k]);//oldrc_gas_nsf;
-                    iaptindex++;
-                }
+            pdata.aperture_rhalfmass_proj_gas_sf[i][k]=encprof_gas_sf.HalfMassRadius(pdata.aperture_mass_proj_gas_sf[i][k]);
+            pdata.aperture_rhalfmass_proj_gas_nsf[i][k]=encprof_gas_nsf.HalfMassRadius(pdata.aperture_mass_proj_gas_nsf[i][k]);
 #endif
 #endif
 #ifdef STARON
-                if (EncMassStar>=0.5*pdata.aperture_mass_proj_star[i][k] && pdata.aperture_rhalfmass_proj_star[i][k]==-1) {
-                    pdata.aperture_rhalfmass_proj_star[i][k]=GetApertureRadiusInterpolation(oldrc_star, rc, EncMassStar, mass, 0.5*pdata.aperture_mass_proj_star[i][k]);//oldrc_star;
-                    iaptindex++;
-                }
-#endif
-            }
-            if (iaptindex==numapttotal) break;
-            oldrc=rc;
-#ifdef GASON
-            if (type==GASTYPE) {
-                oldrc_gas=rc;
-#ifdef STARON
-                if (SFR>opt.gas_sfr_threshold) oldrc_gas_sf=rc;
-                else oldrc_gas_nsf=rc;
-#endif
-            }
-#endif
-#ifdef STARON
-            if (type==STARTYPE) oldrc_star=rc;
-#endif
-#ifdef BHON
-            if (type==BHTYPE) oldrc_bh=rc;
+            pdata.aperture_rhalfmass_proj_star[i][k]=encprof_star.HalfMassRadius(pdata.aperture_mass_proj_star[i][k]);
 #endif
         }
     }
@@ -6205,40 +6157,51 @@ int GetRadialBin(Options &opt, Double_t rc, int &ibin) {
     return ibin;
 }
 
-void AddParticleToRadialBin(Options &opt, Particle *Pval, Double_t irnorm, int &ibin, PropData &pdata)
+///add all the particles of a group, which must be radially sorted, to the radial bins. The group is checked once
+///to see if it needs a profile and the sweep stops at the first particle beyond the last bin edge
+void AddParticlesToRadialBins(Options &opt, const Int_t n, Particle *Part, Double_t irnorm, PropData &pdata)
 {
     if (pdata.gNFOF < opt.profileminFOFsize || pdata.num < opt.profileminsize) return;
-    ibin = GetRadialBin(opt,Pval->Radius()*irnorm, ibin);
-    if (ibin == -1) return;
-    Double_t massval = Pval->GetMass();
-    #ifdef NOMASS
-    massval = opt.MassValue;
-    #endif
-    pdata.profile_mass[ibin] += massval;
-    pdata.profile_npart[ibin] += 1;
+    int ibin=0;
+    Double_t rc, massval, rmax=opt.profile_bin_edges[opt.profile_bin_edges.size()-1];
+    for (Int_t j=0;j<n;j++) {
+        rc=Part[j].Radius()*irnorm;
+        if (rc > rmax) break;
+        while (rc > opt.profile_bin_edges[ibin]) ibin++;
+#ifdef NOMASS
+        massval = opt.MassValue;
+#else
+        massval = Part[j].GetMass();
+#endif
+        pdata.profile_mass[ibin] += massval;
+        pdata.profile_npart[ibin] += 1;
+#if defined(GASON) || defined(STARON)
+        int type = Part[j].GetType();
+#endif
 #ifdef GASON
-    if (Pval->GetType()==GASTYPE) {
-        pdata.profile_mass_gas[ibin] += massval;
-        pdata.profile_npart_gas[ibin] += 1;
+        if (type==GASTYPE) {
+            pdata.profile_mass_gas[ibin] += massval;
+            pdata.profile_npart_gas[ibin] += 1;
 #ifdef STARON
-        if (Pval->GetSFR()>opt.gas_sfr_threshold)
-        {
-            pdata.profile_mass_gas_sf[ibin] += massval;
-            pdata.profile_npart_gas_sf[ibin] += 1;
-        }
-        else {
-            pdata.profile_mass_gas_nsf[ibin] += massval;
-            pdata.profile_npart_gas_nsf[ibin] += 1;
-        }
+            if (Part[j].GetSFR()>opt.gas_sfr_threshold)
+            {
+                pdata.profile_mass_gas_sf[ibin] += massval;
+                pdata.profile_npart_gas_sf[ibin] += 1;
+            }
+            else {
+                pdata.profile_mass_gas_nsf[ibin] += massval;
+                pdata.profile_npart_gas_nsf[ibin] += 1;
+            }
 #endif
-    }
+        }
 #endif
 #ifdef STARON
-    if (Pval->GetType()==STARTYPE) {
-        pdata.profile_mass_star[ibin] += massval;
-        pdata.profile_npart_star[ibin] += 1;
-    }
+        if (type==STARTYPE) {
+            pdata.profile_mass_star[ibin] += massval;
+            pdata.profile_npart_star[ibin] += 1;
+        }
 #endif
+    }
 }
 
 void AddDataToRadialBin(Options &opt, Double_t rval, Double_t massval,
@@ -6314,40 +6277,59 @@ void AddParticleToRadialBinInclusive(Options &opt, Particle *Pval, Double_t irno
 }
 
 
-void AddDataToRadialBinInclusive(Options &opt, Double_t rval, Double_t massval,
+///add the data of a group to the inclusive radial bins, where indices lists the data in increasing radius. The group
+///is checked once to see if it needs a profile and the sweep stops at the first particle beyond the last bin edge.
+///If types is NULL all particles are treated as dark matter.
+void AddDataToRadialBinsInclusive(Options &opt, const vector<Double_t> &radii, const vector<Double_t> &masses,
 #if defined(GASON) || defined(STARON) || defined(BHON)
-    Double_t sfrval, int typeval,
+    const int *types,
 #endif
-    Double_t irnorm, int &ibin, PropData &pdata)
+    const vector<Int_t> &indices, Double_t irnorm, PropData &pdata)
 {
     if (pdata.gNFOF < opt.profileminFOFsize || pdata.num < opt.profileminsize) return;
-    ibin = GetRadialBin(opt,rval*irnorm, ibin);
-    if (ibin == -1) return;
-    pdata.profile_mass_inclusive[ibin] += massval;
-    pdata.profile_npart_inclusive[ibin] += 1;
+    int ibin=0;
+    Double_t rc, massval, rmax=opt.profile_bin_edges[opt.profile_bin_edges.size()-1];
+    for (auto &index:indices) {
+        rc=radii[index]*irnorm;
+        if (rc > rmax) break;
+        while (rc > opt.profile_bin_edges[ibin]) ibin++;
+#ifdef NOMASS
+        massval = opt.MassValue;
+#else
+        massval = masses[index];
+#endif
+        pdata.profile_mass_inclusive[ibin] += massval;
+        pdata.profile_npart_inclusive[ibin] += 1;
+#if defined(GASON) || defined(STARON)
+        int type = (types!=NULL)?types[index]:DARKTYPE;
+#endif
 #ifdef GASON
-    if (typeval==GASTYPE) {
-        pdata.profile_mass_inclusive_gas[ibin] += massval;
-        pdata.profile_npart_inclusive_gas[ibin] += 1;
+        if (type==GASTYPE) {
+            pdata.profile_mass_inclusive_gas[ibin] += massval;
+            pdata.profile_npart_inclusive_gas[ibin] += 1;
 #ifdef STARON
-        if (sfrval>opt.gas_sfr_threshold)
-        {
-            pdata.profile_mass_inclusive_gas_sf[ibin] += massval;
-            pdata.profile_npart_inclusive_gas_sf[ibin] += 1;
-        }
-        else {
-            pdata.profile_mass_inclusive_gas_nsf[ibin] += massval;
-            pdata.profile_npart_inclusive_gas_nsf[ibin] += 1;
-        }
+            ///\todo need to update to allow for star forming/non-star forming profiles
+            ///by storing the star forming value.
+            Double_t sfrval = 0;
+            if (sfrval>opt.gas_sfr_threshold)
+            {
+                pdata.profile_mass_inclusive_gas_sf[ibin] += massval;
+                pdata.profile_npart_inclusive_gas_sf[ibin] += 1;
+            }
+            else {
+                pdata.profile_mass_inclusive_gas_nsf[ibin] += massval;
+                pdata.profile_npart_inclusive_gas_nsf[ibin] += 1;
+            }
 #endif
-    }
+        }
 #endif
 #ifdef STARON
-    if (typeval==STARTYPE) {
-        pdata.profile_mass_inclusive_star[ibin] += massval;
-        pdata.profile_npart_inclusive_star[ibin] += 1;
-    }
+        if (type==STARTYPE) {
+            pdata.profile_mass_inclusive_star[ibin] += massval;
+            pdata.profile_npart_inclusive_star[ibin] += 1;
+        }
 #endif
+    }
 }
 
 //@}
@@ -6355,32 +6337,6 @@ void AddDataToRadialBinInclusive(Options &opt, Double_t rval, Double_t massval,
 /// \name Extra Hydro/Star/BH property calculations
 //@{
 
-inline double ExtraPropGetWeight(unsigned int calctype, double weight){
-    if (calctype < CALCQUANTITYMASSWEIGHT) weight = 1.0;
-    return weight;
-}
-inline void ExtraPropCalcAverage(double weight, double value, double &result){
-    result += value * weight;
-}
-inline void ExtraPropCalcTotal(double weight, double value, double &result){
-    result += value * weight;
-}
-inline void ExtraPropCalcSTD(double weight, double value, double &result){
-    result += value * value * weight;
-}
-inline void ExtraPropCalcLogAverage(double weight, double value, double &result){
-    result += log(value) * weight;
-}
-inline void ExtraPropCalcLogSTD(double weight, double value, double &result){
-    value = log(value);
-    result += value * value * weight;
-}
-inline void ExtraPropCalcMin(double weight, double value, double &result){
-    if (value*weight < result) result = value * weight;
-}
-inline void ExtraPropCalcMax(double weight, double value, double &result){
-    if (value*weight > result) result = value * weight;
-}
 inline double ExtraPropNormalizeValue(unsigned int calctype, double value, double norm){
     calctype = calctype % CALCQUANTITYMASSWEIGHT;
     if (calctype == CALCAVERAGE || calctype == CALCSTD ||
@@ -6421,33 +6377,80 @@ inline double ExtraPropInitValue(unsigned int calctype){
     }
     return result;
 }
-inline ExtraPropFunc ExtraPropSetCalc(unsigned int calctype){
-    calctype = calctype % CALCQUANTITYMASSWEIGHT;
-    ExtraPropFunc f;
-    switch(calctype){
+///accumulate the values of one extra property field over np particles, with the values and particle masses stored contiguously.
+///The calculation type is resolved once for the field so the particle loop is a plain (weighted) reduction
+inline void ExtraPropAccumulate(unsigned int calctype, Int_t np, const double *mass, const double *values, double &result, double &weightsum)
+{
+    bool imassweight = (calctype >= CALCQUANTITYMASSWEIGHT);
+    double w, v;
+    result = ExtraPropInitValue(calctype);
+    weightsum = 0;
+    if (imassweight) for (Int_t i=0;i<np;i++) weightsum += mass[i];
+    else weightsum = np;
+    switch(calctype % CALCQUANTITYMASSWEIGHT){
         case CALCAVERAGE:
-            f = ExtraPropCalcAverage;
-            break;
         case CALCTOTAL:
-            f = ExtraPropCalcTotal;
+            for (Int_t i=0;i<np;i++) {
+                w = imassweight ? mass[i] : 1.0;
+                result += values[i] * w;
+            }
             break;
         case CALCSTD:
-            f = ExtraPropCalcSTD;
+            for (Int_t i=0;i<np;i++) {
+                w = imassweight ? mass[i] : 1.0;
+                result += values[i] * values[i] * w;
+            }
             break;
         case CALCLOGAVERAGE:
-            f = ExtraPropCalcLogAverage;
+            for (Int_t i=0;i<np;i++) {
+                w = imassweight ? mass[i] : 1.0;
+                result += log(values[i]) * w;
+            }
             break;
         case CALCLOGSTD:
-            f = ExtraPropCalcLogSTD;
+            for (Int_t i=0;i<np;i++) {
+                w = imassweight ? mass[i] : 1.0;
+                v = log(values[i]);
+                result += v * v * w;
+            }
             break;
         case CALCMIN:
-            f = ExtraPropCalcMin;
+            for (Int_t i=0;i<np;i++) {
+                w = imassweight ? mass[i] : 1.0;
+                v = values[i] * w;
+                if (v < result) result = v;
+            }
             break;
         case CALCMAX:
-            f = ExtraPropCalcMax;
+            for (Int_t i=0;i<np;i++) {
+                w = imassweight ? mass[i] : 1.0;
+                v = values[i] * w;
+                if (v > result) result = v;
+            }
             break;
     }
-    return f;
+}
+
+///calculate the final values of a list of extra property fields, gathering the np particle values of one field at a time
+///(given by getvalue(field index, particle index)) into the reused values buffer and reducing it, then adjusting paired
+///calculations (a standard deviation and its average) in the order the fields are listed
+template<typename F> inline void ExtraPropCalcFields(Int_t np, vector<double> &mass, vector<double> &values,
+    vector<int> &functions, vector<int> &pairedindex, vector<double> &result, F getvalue)
+{
+    double weightsum;
+    result.resize(functions.size());
+    values.resize(np);
+    for (auto iextra=0;iextra<functions.size();iextra++)
+    {
+        for (Int_t i=0;i<np;i++) values[i] = getvalue(iextra, i);
+        ExtraPropAccumulate(functions[iextra], np, mass.data(), values.data(), result[iextra], weightsum);
+        result[iextra] = ExtraPropNormalizeValue(functions[iextra], result[iextra], weightsum);
+    }
+    for (auto iextra=0;iextra<functions.size();iextra++)
+    {
+        if (pairedindex[iextra] == iextra) continue;
+        result[iextra] = ExtraPropAdjustForPairedValue(functions[iextra], result[iextra], result[pairedindex[iextra]]);
+    }
 }
 
 ///Calculate the average mass weighted value of a chemical and how it was produced
@@ -6456,142 +6459,42 @@ void GetExtraHydroProperties(Options &opt, PropData &pdata, Int_t n, Particle *P
 {
 #ifdef GASON
     if (opt.gas_internalprop_names.size() + opt.gas_chem_names.size() + opt.gas_chemproduction_names.size() == 0) return;
-    HydroProperties x;
-    map<string, double> value, weightsum;
-    string extrafield, outputfield, outputfield2;
-    double oldweight, weight, curvalue, result;
-    map<string, ExtraPropFunc> funcs;
+    vector<HydroProperties*> x;
+    vector<double> mass, values, result;
+    Int_t np;
 
-    //initialize map stored in the properties data
+    //initialize values stored in the properties data
     for (auto iextra=0;iextra<opt.gas_internalprop_names.size();iextra++)
-    {
-        extrafield = opt.gas_internalprop_names[iextra];
-        outputfield = opt.gas_internalprop_output_names[iextra];
-        value[outputfield] = ExtraPropInitValue(opt.gas_internalprop_function[iextra]);
-        weightsum[outputfield] = 0;
-        funcs[outputfield] = ExtraPropSetCalc(opt.gas_internalprop_function[iextra]);
-        pdata.hydroprop.SetInternalProperties(outputfield, 0);
-    }
+        pdata.hydroprop.SetInternalProperties(opt.gas_internalprop_output_names[iextra], 0);
     for (auto iextra=0;iextra<opt.gas_chem_names.size();iextra++)
-    {
-        extrafield = opt.gas_chem_names[iextra];
-        outputfield = opt.gas_chem_output_names[iextra];
-        value[outputfield] = ExtraPropInitValue(opt.gas_chem_function[iextra]);
-        weightsum[outputfield] = 0;
-        funcs[outputfield] = ExtraPropSetCalc(opt.gas_chem_function[iextra]);
-        pdata.hydroprop.SetChemistry(outputfield, 0);
-    }
+        pdata.hydroprop.SetChemistry(opt.gas_chem_output_names[iextra], 0);
     for (auto iextra=0;iextra<opt.gas_chemproduction_names.size();iextra++)
-    {
-        extrafield = opt.gas_chemproduction_names[iextra];
-        outputfield = opt.gas_chemproduction_output_names[iextra];
-        value[outputfield] = ExtraPropInitValue(opt.gas_chemproduction_function[iextra]);
-        weightsum[outputfield] = 0;
-        funcs[outputfield] = ExtraPropSetCalc(opt.gas_chemproduction_function[iextra]);
-        pdata.hydroprop.SetChemistryProduction(outputfield, 0);
-    }
+        pdata.hydroprop.SetChemistryProduction(opt.gas_chemproduction_output_names[iextra], 0);
     if (pdata.n_gas == 0 ) return;
+
+    //collect the particles once, then gather and reduce one field at a time
     for (auto i=0;i<n;i++)
     {
         if (Pval[i].GetType()!=GASTYPE || !Pval[i].HasHydroProperties()) continue;
-        x = Pval[i].GetHydroProperties();
-        oldweight = Pval[i].GetMass();
-        for (auto iextra=0;iextra<opt.gas_internalprop_names.size();iextra++)
-        {
-            extrafield = opt.gas_internalprop_names[iextra];
-            outputfield = opt.gas_internalprop_output_names[iextra];
-            weight = ExtraPropGetWeight(opt.gas_internalprop_function[iextra], oldweight);
-            curvalue = x.GetInternalProperties(extrafield);
-            weightsum[outputfield] += weight;
-            funcs[outputfield](weight, curvalue, value[outputfield]);
-        }
-        for (auto iextra=0;iextra<opt.gas_chem_names.size();iextra++)
-        {
-            extrafield = opt.gas_chem_names[iextra];
-            outputfield = opt.gas_chem_output_names[iextra];
-            weight = ExtraPropGetWeight(opt.gas_chem_function[iextra], oldweight);
-            curvalue = x.GetChemistry(extrafield);
-            weightsum[outputfield] += weight;
-            funcs[outputfield](weight, curvalue, value[outputfield]);
-        }
-        for (auto iextra=0;iextra<opt.gas_chemproduction_names.size();iextra++)
-        {
-            extrafield = opt.gas_chemproduction_names[iextra];
-            outputfield = opt.gas_chemproduction_output_names[iextra];
-            weight = ExtraPropGetWeight(opt.gas_chemproduction_function[iextra], oldweight);
-            curvalue = x.GetChemistryProduction(extrafield);
-            weightsum[outputfield] += weight;
-            funcs[outputfield](weight, curvalue, value[outputfield]);
-        }
+        x.push_back(&Pval[i].GetHydroProperties());
+        mass.push_back(Pval[i].GetMass());
     }
+    np = x.size();
 
-    //normalize as necessary
+    ExtraPropCalcFields(np, mass, values, opt.gas_internalprop_function, opt.gas_internalprop_index_paired_calc, result,
+        [&](int iextra, Int_t i) {return x[i]->GetInternalProperties(opt.gas_internalprop_names[iextra]);});
     for (auto iextra=0;iextra<opt.gas_internalprop_names.size();iextra++)
-    {
-        extrafield = opt.gas_internalprop_names[iextra];
-        outputfield = opt.gas_internalprop_output_names[iextra];
-        result = ExtraPropNormalizeValue(opt.gas_internalprop_function[iextra], value[outputfield], weightsum[outputfield]);
-        value[outputfield] = result;
-    }
-    for (auto iextra=0;iextra<opt.gas_chem_names.size();iextra++)
-    {
-        extrafield = opt.gas_chem_names[iextra];
-        outputfield = opt.gas_chem_output_names[iextra];
-        result = ExtraPropNormalizeValue(opt.gas_chem_function[iextra], value[outputfield], weightsum[outputfield]);
-        value[outputfield] = result;
-    }
-    for (auto iextra=0;iextra<opt.gas_chemproduction_names.size();iextra++)
-    {
-        extrafield = opt.gas_chemproduction_names[iextra];
-        outputfield = opt.gas_chemproduction_output_names[iextra];
-        result = ExtraPropNormalizeValue(opt.gas_chemproduction_function[iextra], value[outputfield], weightsum[outputfield]);
-        value[outputfield] = result;
-    }
+        pdata.hydroprop.SetInternalProperties(opt.gas_internalprop_output_names[iextra], result[iextra]);
 
-    //for calculations that depend on other values
-    for (auto iextra=0;iextra<opt.gas_internalprop_names.size();iextra++)
-    {
-        if (opt.gas_internalprop_index_paired_calc[iextra] == iextra) continue;
-        int iextra2 = opt.gas_internalprop_index_paired_calc[iextra];
-        outputfield = opt.gas_internalprop_output_names[iextra];
-        outputfield2 = opt.gas_internalprop_output_names[iextra2];
-        result = ExtraPropAdjustForPairedValue(opt.gas_internalprop_function[iextra], value[outputfield], value[outputfield2]);
-        value[outputfield] = result;
-    }
+    ExtraPropCalcFields(np, mass, values, opt.gas_chem_function, opt.gas_chem_index_paired_calc, result,
+        [&](int iextra, Int_t i) {return x[i]->GetChemistry(opt.gas_chem_names[iextra]);});
     for (auto iextra=0;iextra<opt.gas_chem_names.size();iextra++)
-    {
-        if (opt.gas_chem_index_paired_calc[iextra] == iextra) continue;
-        int iextra2 = opt.gas_chem_index_paired_calc[iextra];
-        outputfield = opt.gas_chem_output_names[iextra];
-        outputfield2 = opt.gas_chem_output_names[iextra2];
-        result = ExtraPropAdjustForPairedValue(opt.gas_chem_function[iextra], value[outputfield], value[outputfield2]);
-        value[outputfield] = result;
-    }
-    for (auto iextra=0;iextra<opt.gas_chemproduction_names.size();iextra++)
-    {
-        if (opt.gas_chemproduction_index_paired_calc[iextra] == iextra) continue;
-        int iextra2 = opt.gas_chemproduction_index_paired_calc[iextra];
-        outputfield = opt.gas_chemproduction_output_names[iextra];
-        outputfield2 = opt.gas_chemproduction_output_names[iextra2];
-        result = ExtraPropAdjustForPairedValue(opt.gas_chemproduction_function[iextra], value[outputfield], value[outputfield2]);
-        value[outputfield] = result;
-    }
+        pdata.hydroprop.SetChemistry(opt.gas_chem_output_names[iextra], result[iextra]);
 
-    for (auto iextra=0;iextra<opt.gas_internalprop_names.size();iextra++)
-    {
-        outputfield = opt.gas_internalprop_output_names[iextra];
-        pdata.hydroprop.SetInternalProperties(outputfield, value[outputfield]);
-    }
-    for (auto iextra=0;iextra<opt.gas_chem_names.size();iextra++)
-    {
-        outputfield = opt.gas_chem_output_names[iextra];
-        pdata.hydroprop.SetChemistry(outputfield, value[outputfield]);
-    }
+    ExtraPropCalcFields(np, mass, values, opt.gas_chemproduction_function, opt.gas_chemproduction_index_paired_calc, result,
+        [&](int iextra, Int_t i) {return x[i]->GetChemistryProduction(opt.gas_chemproduction_names[iextra]);});
     for (auto iextra=0;iextra<opt.gas_chemproduction_names.size();iextra++)
-    {
-        outputfield = opt.gas_chemproduction_output_names[iextra];
-        pdata.hydroprop.SetChemistryProduction(outputfield, value[outputfield]);
-    }
+        pdata.hydroprop.SetChemistryProduction(opt.gas_chemproduction_output_names[iextra], result[iextra]);
 #endif
 }
 
@@ -6601,142 +6504,42 @@ void GetExtraStarProperties(Options &opt, PropData &pdata, Int_t n, Particle *Pv
 {
 #ifdef STARON
     if (opt.star_internalprop_names.size() + opt.star_chem_names.size() + opt.star_chemproduction_names.size() == 0) return;
-    StarProperties x;
-    map<string, double> value, weightsum;
-    string extrafield, outputfield, outputfield2;
-    double oldweight, weight, curvalue, result;
-    map<string, ExtraPropFunc> funcs;
+    vector<StarProperties*> x;
+    vector<double> mass, values, result;
+    Int_t np;
 
-    //initialize map stored in the properties data
+    //initialize values stored in the properties data
     for (auto iextra=0;iextra<opt.star_internalprop_names.size();iextra++)
-    {
-        extrafield = opt.star_internalprop_names[iextra];
-        outputfield = opt.star_internalprop_output_names[iextra];
-        value[outputfield] = ExtraPropInitValue(opt.star_internalprop_function[iextra]);
-        weightsum[outputfield] = 0;
-        funcs[outputfield] = ExtraPropSetCalc(opt.star_internalprop_function[iextra]);
-        pdata.starprop.SetInternalProperties(outputfield, 0);
-    }
+        pdata.starprop.SetInternalProperties(opt.star_internalprop_output_names[iextra], 0);
     for (auto iextra=0;iextra<opt.star_chem_names.size();iextra++)
-    {
-        extrafield = opt.star_chem_names[iextra];
-        outputfield = opt.star_chem_output_names[iextra];
-        value[outputfield] = ExtraPropInitValue(opt.star_chem_function[iextra]);
-        weightsum[outputfield] = 0;
-        funcs[outputfield] = ExtraPropSetCalc(opt.star_chem_function[iextra]);
-        pdata.starprop.SetChemistry(outputfield, 0);
-    }
+        pdata.starprop.SetChemistry(opt.star_chem_output_names[iextra], 0);
     for (auto iextra=0;iextra<opt.star_chemproduction_names.size();iextra++)
-    {
-        extrafield = opt.star_chemproduction_names[iextra];
-        outputfield = opt.star_chemproduction_output_names[iextra];
-        value[outputfield] = ExtraPropInitValue(opt.star_chemproduction_function[iextra]);
-        weightsum[outputfield] = 0;
-        funcs[outputfield] = ExtraPropSetCalc(opt.star_chemproduction_function[iextra]);
-        pdata.starprop.SetChemistryProduction(outputfield, 0);
-    }
+        pdata.starprop.SetChemistryProduction(opt.star_chemproduction_output_names[iextra], 0);
     if (pdata.n_star == 0 ) return;
+
+    //collect the particles once, then gather and reduce one field at a time
     for (auto i=0;i<n;i++)
     {
         if (Pval[i].GetType()!=STARTYPE || !Pval[i].HasStarProperties()) continue;
-        x = Pval[i].GetStarProperties();
-        oldweight = Pval[i].GetMass();
-        for (auto iextra=0;iextra<opt.star_internalprop_names.size();iextra++)
-        {
-            extrafield = opt.star_internalprop_names[iextra];
-            outputfield = opt.star_internalprop_output_names[iextra];
-            weight = ExtraPropGetWeight(opt.star_internalprop_function[iextra], oldweight);
-            curvalue = x.GetInternalProperties(extrafield);
-            weightsum[outputfield] += weight;
-            funcs[outputfield](weight, curvalue, value[outputfield]);
-        }
-        for (auto iextra=0;iextra<opt.star_chem_names.size();iextra++)
-        {
-            extrafield = opt.star_chem_names[iextra];
-            outputfield = opt.star_chem_output_names[iextra];
-            weight = ExtraPropGetWeight(opt.star_chem_function[iextra], oldweight);
-            curvalue = x.GetChemistry(extrafield);
-            weightsum[outputfield] += weight;
-            funcs[outputfield](weight, curvalue, value[outputfield]);
-        }
-        for (auto iextra=0;iextra<opt.star_chemproduction_names.size();iextra++)
-        {
-            extrafield = opt.star_chemproduction_names[iextra];
-            outputfield = opt.star_chemproduction_output_names[iextra];
-            weight = ExtraPropGetWeight(opt.star_chemproduction_function[iextra], oldweight);
-            curvalue = x.GetChemistryProduction(extrafield);
-            weightsum[outputfield] += weight;
-            funcs[outputfield](weight, curvalue, value[outputfield]);
-        }
+        x.push_back(&Pval[i].GetStarProperties());
+        mass.push_back(Pval[i].GetMass());
     }
+    np = x.size();
 
-    //normalize as necessary
+    ExtraPropCalcFields(np, mass, values, opt.star_internalprop_function, opt.star_internalprop_index_paired_calc, result,
+        [&](int iextra, Int_t i) {return x[i]->GetInternalProperties(opt.star_internalprop_names[iextra]);});
     for (auto iextra=0;iextra<opt.star_internalprop_names.size();iextra++)
-    {
-        extrafield = opt.star_internalprop_names[iextra];
-        outputfield = opt.star_internalprop_output_names[iextra];
-        result = ExtraPropNormalizeValue(opt.star_internalprop_function[iextra], value[outputfield], weightsum[outputfield]);
-        value[outputfield] = result;
-    }
-    for (auto iextra=0;iextra<opt.star_chem_names.size();iextra++)
-    {
-        extrafield = opt.star_chem_names[iextra];
-        outputfield = opt.star_chem_output_names[iextra];
-        result = ExtraPropNormalizeValue(opt.star_chem_function[iextra], value[outputfield], weightsum[outputfield]);
-        value[outputfield] = result;
-    }
-    for (auto iextra=0;iextra<opt.star_chemproduction_names.size();iextra++)
-    {
-        extrafield = opt.star_chemproduction_names[iextra];
-        outputfield = opt.star_chemproduction_output_names[iextra];
-        result = ExtraPropNormalizeValue(opt.star_chemproduction_function[iextra], value[outputfield], weightsum[outputfield]);
-        value[outputfield] = result;
-    }
+        pdata.starprop.SetInternalProperties(opt.star_internalprop_output_names[iextra], result[iextra]);
 
-    //for calculations that depend on other values
-    for (auto iextra=0;iextra<opt.star_internalprop_names.size();iextra++)
-    {
-        if (opt.star_internalprop_index_paired_calc[iextra] == iextra) continue;
-        int iextra2 = opt.star_internalprop_index_paired_calc[iextra];
-        outputfield = opt.star_internalprop_output_names[iextra];
-        outputfield2 = opt.star_internalprop_output_names[iextra2];
-        result = ExtraPropAdjustForPairedValue(opt.star_internalprop_function[iextra], value[outputfield], value[outputfield2]);
-        value[outputfield] = result;
-    }
+    ExtraPropCalcFields(np, mass, values, opt.star_chem_function, opt.star_chem_index_paired_calc, result,
+        [&](int iextra, Int_t i) {return x[i]->GetChemistry(opt.star_chem_names[iextra]);});
     for (auto iextra=0;iextra<opt.star_chem_names.size();iextra++)
-    {
-        if (opt.star_chem_index_paired_calc[iextra] == iextra) continue;
-        int iextra2 = opt.star_chem_index_paired_calc[iextra];
-        outputfield = opt.star_chem_output_names[iextra];
-        outputfield2 = opt.star_chem_output_names[iextra2];
-        result = ExtraPropAdjustForPairedValue(opt.star_chem_function[iextra], value[outputfield], value[outputfield2]);
-        value[outputfield] = result;
-    }
-    for (auto iextra=0;iextra<opt.star_chemproduction_names.size();iextra++)
-    {
-        if (opt.star_chemproduction_index_paired_calc[iextra] == iextra) continue;
-        int iextra2 = opt.star_chemproduction_index_paired_calc[iextra];
-        outputfield = opt.star_chemproduction_output_names[iextra];
-        outputfield2 = opt.star_chemproduction_output_names[iextra2];
-        result = ExtraPropAdjustForPairedValue(opt.star_chemproduction_function[iextra], value[outputfield], value[outputfield2]);
-        value[outputfield] = result;
-    }
+        pdata.starprop.SetChemistry(opt.star_chem_output_names[iextra], result[iextra]);
 
-    for (auto iextra=0;iextra<opt.star_internalprop_names.size();iextra++)
-    {
-        outputfield = opt.star_internalprop_output_names[iextra];
-        pdata.starprop.SetInternalProperties(outputfield, value[outputfield]);
-    }
-    for (auto iextra=0;iextra<opt.star_chem_names.size();iextra++)
-    {
-        outputfield = opt.star_chem_output_names[iextra];
-        pdata.starprop.SetChemistry(outputfield, value[outputfield]);
-    }
+    ExtraPropCalcFields(np, mass, values, opt.star_chemproduction_function, opt.star_chemproduction_index_paired_calc, result,
+        [&](int iextra, Int_t i) {return x[i]->GetChemistryProduction(opt.star_chemproduction_names[iextra]);});
     for (auto iextra=0;iextra<opt.star_chemproduction_names.size();iextra++)
-    {
-        outputfield = opt.star_chemproduction_output_names[iextra];
-        pdata.starprop.SetChemistryProduction(outputfield, value[outputfield]);
-    }
+        pdata.starprop.SetChemistryProduction(opt.star_chemproduction_output_names[iextra], result[iextra]);
 #endif
 }
 
@@ -6746,142 +6549,42 @@ void GetExtraBHProperties(Options &opt, PropData &pdata, Int_t n, Particle *Pval
 {
 #ifdef BHON
     if (opt.bh_internalprop_names.size() + opt.bh_chem_names.size() + opt.bh_chemproduction_names.size() == 0) return;
-    BHProperties x;
-    map<string, double> value, weightsum;
-    string extrafield, outputfield, outputfield2;
-    double oldweight, weight, curvalue, result;
-    map<string, ExtraPropFunc> funcs;
+    vector<BHProperties*> x;
+    vector<double> mass, values, result;
+    Int_t np;
 
-    //initialize map stored in the properties data
+    //initialize values stored in the properties data
     for (auto iextra=0;iextra<opt.bh_internalprop_names.size();iextra++)
-    {
-        extrafield = opt.bh_internalprop_names[iextra];
-        outputfield = opt.bh_internalprop_output_names[iextra];
-        value[outputfield] = ExtraPropInitValue(opt.bh_internalprop_function[iextra]);
-        weightsum[outputfield] = 0;
-        funcs[outputfield] = ExtraPropSetCalc(opt.bh_internalprop_function[iextra]);
-        pdata.bhprop.SetInternalProperties(outputfield, 0);
-    }
+        pdata.bhprop.SetInternalProperties(opt.bh_internalprop_output_names[iextra], 0);
     for (auto iextra=0;iextra<opt.bh_chem_names.size();iextra++)
-    {
-        extrafield = opt.bh_chem_names[iextra];
-        outputfield = opt.bh_chem_output_names[iextra];
-        value[outputfield] = ExtraPropInitValue(opt.bh_chem_function[iextra]);
-        weightsum[outputfield] = 0;
-        funcs[outputfield] = ExtraPropSetCalc(opt.bh_chem_function[iextra]);
-        pdata.bhprop.SetChemistry(outputfield, 0);
-    }
+        pdata.bhprop.SetChemistry(opt.bh_chem_output_names[iextra], 0);
     for (auto iextra=0;iextra<opt.bh_chemproduction_names.size();iextra++)
-    {
-        extrafield = opt.bh_chemproduction_names[iextra];
-        outputfield = opt.bh_chemproduction_output_names[iextra];
-        value[outputfield] = ExtraPropInitValue(opt.bh_chemproduction_function[iextra]);
-        weightsum[outputfield] = 0;
-        funcs[outputfield] = ExtraPropSetCalc(opt.bh_chemproduction_function[iextra]);
-        pdata.bhprop.SetChemistryProduction(outputfield, 0);
-    }
+        pdata.bhprop.SetChemistryProduction(opt.bh_chemproduction_output_names[iextra], 0);
     if (pdata.n_bh == 0 ) return;
+
+    //collect the particles once, then gather and reduce one field at a time
     for (auto i=0;i<n;i++)
     {
         if (Pval[i].GetType()!=BHTYPE || !Pval[i].HasBHProperties()) continue;
-        x = Pval[i].GetBHProperties();
-        oldweight = Pval[i].GetMass();
-        for (auto iextra=0;iextra<opt.bh_internalprop_names.size();iextra++)
-        {
-            extrafield = opt.bh_internalprop_names[iextra];
-            outputfield = opt.bh_internalprop_output_names[iextra];
-            weight = ExtraPropGetWeight(opt.bh_internalprop_function[iextra], oldweight);
-            curvalue = x.GetInternalProperties(extrafield);
-            weightsum[outputfield] += weight;
-            funcs[outputfield](weight, curvalue, value[outputfield]);
-        }
-        for (auto iextra=0;iextra<opt.bh_chem_names.size();iextra++)
-        {
-            extrafield = opt.bh_chem_names[iextra];
-            outputfield = opt.bh_chem_output_names[iextra];
-            weight = ExtraPropGetWeight(opt.bh_chem_function[iextra], oldweight);
-            curvalue = x.GetChemistry(extrafield);
-            weightsum[outputfield] += weight;
-            funcs[outputfield](weight, curvalue, value[outputfield]);
-        }
-        for (auto iextra=0;iextra<opt.bh_chemproduction_names.size();iextra++)
-        {
-            extrafield = opt.bh_chemproduction_names[iextra];
-            outputfield = opt.bh_chemproduction_output_names[iextra];
-            weight = ExtraPropGetWeight(opt.bh_chemproduction_function[iextra], oldweight);
-            curvalue = x.GetChemistryProduction(extrafield);
-            weightsum[outputfield] += weight;
-            funcs[outputfield](weight, curvalue, value[outputfield]);
-        }
+        x.push_back(&Pval[i].GetBHProperties());
+        mass.push_back(Pval[i].GetMass());
     }
+    np = x.size();
 
-    //normalize as necessary
+    ExtraPropCalcFields(np, mass, values, opt.bh_internalprop_function, opt.bh_internalprop_index_paired_calc, result,
+        [&](int iextra, Int_t i) {return x[i]->GetInternalProperties(opt.bh_internalprop_names[iextra]);});
     for (auto iextra=0;iextra<opt.bh_internalprop_names.size();iextra++)
-    {
-        extrafield = opt.bh_internalprop_names[iextra];
-        outputfield = opt.bh_internalprop_output_names[iextra];
-        result = ExtraPropNormalizeValue(opt.bh_internalprop_function[iextra], value[outputfield], weightsum[outputfield]);
-        value[outputfield] = result;
-    }
-    for (auto iextra=0;iextra<opt.bh_chem_names.size();iextra++)
-    {
-        extrafield = opt.bh_chem_names[iextra];
-        outputfield = opt.bh_chem_output_names[iextra];
-        result = ExtraPropNormalizeValue(opt.bh_chem_function[iextra], value[outputfield], weightsum[outputfield]);
-        value[outputfield] = result;
-    }
-    for (auto iextra=0;iextra<opt.bh_chemproduction_names.size();iextra++)
-    {
-        extrafield = opt.bh_chemproduction_names[iextra];
-        outputfield = opt.bh_chemproduction_output_names[iextra];
-        result = ExtraPropNormalizeValue(opt.bh_chemproduction_function[iextra], value[outputfield], weightsum[outputfield]);
-        value[outputfield] = result;
-    }
+        pdata.bhprop.SetInternalProperties(opt.bh_internalprop_output_names[iextra], result[iextra]);
 
-    //for calculations that depend on other values
-    for (auto iextra=0;iextra<opt.bh_internalprop_names.size();iextra++)
-    {
-        if (opt.bh_internalprop_index_paired_calc[iextra] == iextra) continue;
-        int iextra2 = opt.bh_internalprop_index_paired_calc[iextra];
-        outputfield = opt.bh_internalprop_output_names[iextra];
-        outputfield2 = opt.bh_internalprop_output_names[iextra2];
-        result = ExtraPropAdjustForPairedValue(opt.bh_internalprop_function[iextra], value[outputfield], value[outputfield2]);
-        value[outputfield] = result;
-    }
+    ExtraPropCalcFields(np, mass, values, opt.bh_chem_function, opt.bh_chem_index_paired_calc, result,
+        [&](int iextra, Int_t i) {return x[i]->GetChemistry(opt.bh_chem_names[iextra]);});
     for (auto iextra=0;iextra<opt.bh_chem_names.size();iextra++)
-    {
-        if (opt.bh_chem_index_paired_calc[iextra] == iextra) continue;
-        int iextra2 = opt.bh_chem_index_paired_calc[iextra];
-        outputfield = opt.bh_chem_output_names[iextra];
-        outputfield2 = opt.bh_chem_output_names[iextra2];
-        result = ExtraPropAdjustForPairedValue(opt.bh_chem_function[iextra], value[outputfield], value[outputfield2]);
-        value[outputfield] = result;
-    }
-    for (auto iextra=0;iextra<opt.bh_chemproduction_names.size();iextra++)
-    {
-        if (opt.bh_chemproduction_index_paired_calc[iextra] == iextra) continue;
-        int iextra2 = opt.bh_chemproduction_index_paired_calc[iextra];
-        outputfield = opt.bh_chemproduction_output_names[iextra];
-        outputfield2 = opt.bh_chemproduction_output_names[iextra2];
-        result = ExtraPropAdjustForPairedValue(opt.bh_chemproduction_function[iextra], value[outputfield], value[outputfield2]);
-        value[outputfield] = result;
-    }
+        pdata.bhprop.SetChemistry(opt.bh_chem_output_names[iextra], result[iextra]);
 
-    for (auto iextra=0;iextra<opt.bh_internalprop_names.size();iextra++)
-    {
-        outputfield = opt.bh_internalprop_output_names[iextra];
-        pdata.bhprop.SetInternalProperties(outputfield, value[outputfield]);
-    }
-    for (auto iextra=0;iextra<opt.bh_chem_names.size();iextra++)
-    {
-        outputfield = opt.bh_chem_output_names[iextra];
-        pdata.bhprop.SetChemistry(outputfield, value[outputfield]);
-    }
+    ExtraPropCalcFields(np, mass, values, opt.bh_chemproduction_function, opt.bh_chemproduction_index_paired_calc, result,
+        [&](int iextra, Int_t i) {return x[i]->GetChemistryProduction(opt.bh_chemproduction_names[iextra]);});
     for (auto iextra=0;iextra<opt.bh_chemproduction_names.size();iextra++)
-    {
-        outputfield = opt.bh_chemproduction_output_names[iextra];
-        pdata.bhprop.SetChemistryProduction(outputfield, value[outputfield]);
-    }
+        pdata.bhprop.SetChemistryProduction(opt.bh_chemproduction_output_names[iextra], result[iextra]);
 #endif
 }
 
@@ -6889,61 +6592,28 @@ void GetExtraDMProperties(Options &opt, PropData &pdata, Int_t n, Particle *Pval
 {
 #ifdef EXTRADMON
     if (opt.extra_dm_internalprop_names.size() == 0) return;
-    ExtraDMProperties x;
-    map<string, double> value, weightsum;
-    string extrafield, outputfield, outputfield2;
-    double oldweight, weight, curvalue, result;
-    map<string, ExtraPropFunc> funcs;
+    vector<ExtraDMProperties*> x;
+    vector<double> mass, values, result;
+    Int_t np;
 
-    //initialize map stored in the properties data
+    //initialize values stored in the properties data
     for (auto iextra=0;iextra<opt.extra_dm_internalprop_names.size();iextra++)
-    {
-        extrafield = opt.extra_dm_internalprop_names[iextra];
-        outputfield = opt.extra_dm_internalprop_output_names[iextra];
-        value[outputfield] = ExtraPropInitValue(opt.extra_dm_internalprop_function[iextra]);
-        weightsum[outputfield] = 0;
-        funcs[outputfield] = ExtraPropSetCalc(opt.extra_dm_internalprop_function[iextra]);
-        pdata.extradmprop.SetExtraProperties(outputfield, 0);
-    }
+        pdata.extradmprop.SetExtraProperties(opt.extra_dm_internalprop_output_names[iextra], 0);
     if (pdata.n_dm == 0) return;
+
+    //collect the particles once, then gather and reduce one field at a time
     for (auto i=0;i<n;i++)
     {
         if (Pval[i].GetType()!=DARKTYPE || !Pval[i].HasExtraDMProperties()) continue;
-        x = Pval[i].GetExtraDMProperties();
-        oldweight = Pval[i].GetMass();
-        for (auto iextra=0;iextra<opt.extra_dm_internalprop_names.size();iextra++)
-        {
-            extrafield = opt.extra_dm_internalprop_names[iextra];
-            outputfield = opt.extra_dm_internalprop_output_names[iextra];
-            weight = ExtraPropGetWeight(opt.extra_dm_internalprop_function[iextra], oldweight);
-            curvalue = x.GetExtraProperties(extrafield);
-            weightsum[outputfield] += weight;
-            funcs[outputfield](weight, curvalue, value[outputfield]);
-        }
-    }
-    //normalize as necessary
-    for (auto iextra=0;iextra<opt.extra_dm_internalprop_names.size();iextra++)
-    {
-        extrafield = opt.extra_dm_internalprop_names[iextra];
-        outputfield = opt.extra_dm_internalprop_output_names[iextra];
-        result = ExtraPropNormalizeValue(opt.extra_dm_internalprop_function[iextra], value[outputfield], weightsum[outputfield]);
-        value[outputfield] = result;
-    }
-    //for calculations that depend on other values
-    for (auto iextra=0;iextra<opt.extra_dm_internalprop_names.size();iextra++)
-    {
-        if (opt.extra_dm_internalprop_index_paired_calc[iextra] == iextra) continue;
-        int iextra2 = opt.extra_dm_internalprop_index_paired_calc[iextra];
-        outputfield = opt.extra_dm_internalprop_output_names[iextra];
-        outputfield2 = opt.extra_dm_internalprop_output_names[iextra2];
-        result = ExtraPropAdjustForPairedValue(opt.extra_dm_internalprop_function[iextra], value[outputfield], value[outputfield2]);
-        value[outputfield] = result;
+        x.push_back(&Pval[i].GetExtraDMProperties());
+        mass.push_back(Pval[i].GetMass());
     }
+    np = x.size();
+
+    ExtraPropCalcFields(np, mass, values, opt.extra_dm_internalprop_function, opt.extra_dm_internalprop_index_paired_calc, result,
+        [&](int iextra, Int_t i) {return x[i]->GetExtraProperties(opt.extra_dm_internalprop_names[iextra]);});
     for (auto iextra=0;iextra<opt.extra_dm_internalprop_names.size();iextra++)
-    {
-        outputfield = opt.extra_dm_internalprop_output_names[iextra];
-        pdata.extradmprop.SetExtraProperties(outputfield, value[outputfield]);
-    }
+        pdata.extradmprop.SetExtraProperties(opt.extra_dm_internalprop_output_names[iextra], result[iextra]);
 #endif
 }
 //@}
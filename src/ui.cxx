@@ -409,6 +409,8 @@ void usage(void)
     \section propconfigs Property calculation options
     \arg <b> \e Inclusive_halo_mass </b> 1/0 flag indicating whether inclusive masses are calculated for field objects. \ref Options.iInclusiveHalo \n
     \arg <b> \e Extensive_halo_properties_output </b> 1/0 flag indicating whether to calculate/output even more halo properties. \ref Options.iextrahalooutput \n
+    \arg <b> \e Property_kernels </b> bit mask of the groups of properties calculated beyond the basic mass, angular momentum and circular velocity quantities: 1 rotational support, 2 quantities within Rmax, 4 morphology, 8 per particle type properties (default 15, all). Properties of disabled groups are set to -1, \ref PROPUNSETVALUE, or NaN if they can be negative, \ref PROPUNSETSIGNEDVALUE. \ref Options.ipropertykernels \n
+    \arg <b> \e Aperture_min_size </b>, <b> \e RVmax_properties_min_size </b>, <b> \e Morphology_min_size </b>, <b> \e Extra_properties_min_size </b> minimum number of particles an object needs for aperture, within Rmax, morphology and extra hydro/star/BH property calculations (default 0). Skipped quantities of smaller objects are set to -1, \ref PROPUNSETVALUE, or NaN if they can be negative, \ref PROPUNSETSIGNEDVALUE. \ref Options.apertureminsize \ref Options.rvmaxminsize \ref Options.morphologyminsize \ref Options.extrapropminsize \n
     \arg <b> \e Extended_output </b> 1/0 flag indicating whether produce extended output for quick particle extraction from input catalog of particles in structures \ref Options.iextendedoutput \n
     \arg <b> \e Iterate_cm_flag </b> 1/0 flag indicating whether to use shrinking spheres to calculate the center of mass and velocity. \ref Options.iIterateCM \n
     \arg <b> \e Sort_by_binding_energy </b> 1/0 flag indicating whether to sort by particle binding energy or by potential (if 0). \ref Options.iSortByBindingEnergy \n
@@ -880,6 +882,15 @@ void GetParamFile(Options &opt)
                         opt.ellhalophysfac = atof(vbuff);
                     else if (strcmp(tbuff, "Halo_3D_linking_length")==0)
                         opt.ellhalo3dxfac = atof(vbuff);
+                    else if (strcmp(tbuff, "Halo_3D_multi_linking_lengths")==0) {
+                        pos=0;
+                        dataline=string(vbuff);
+                        while ((pos = dataline.find(delimiter)) != string::npos) {
+                            token = dataline.substr(0, pos);
+                            opt.ellhalo3dmultixfac.push_back(stof(token));
+                            dataline.erase(0, pos + delimiter.length());
+                        }
+                    }
                     else if (strcmp(tbuff, "Halo_velocity_linking_length_factor")==0)
                         opt.ellhalovelfac = atof(vbuff);
                     //specific to 6DFOF field search
@@ -1056,6 +1067,16 @@ void GetParamFile(Options &opt)
                     }
                     else if (strcmp(tbuff, "Extensive_halo_properties_output")==0)
                         opt.iextrahalooutput = atoi(vbuff);
+                    else if (strcmp(tbuff, "Property_kernels")==0)
+                        opt.ipropertykernels = atoi(vbuff);
+                    else if (strcmp(tbuff, "Aperture_min_size")==0)
+                        opt.apertureminsize = atoi(vbuff);
+                    else if (strcmp(tbuff, "RVmax_properties_min_size")==0)
+                        opt.rvmaxminsize = atoi(vbuff);
+                    else if (strcmp(tbuff, "Morphology_min_size")==0)
+                        opt.morphologyminsize = atoi(vbuff);
+                    else if (strcmp(tbuff, "Extra_properties_min_size")==0)
+                        opt.extrapropminsize = atoi(vbuff);
                     else if (strcmp(tbuff, "Extensive_gas_properties_output")==0)
                         opt.iextragasoutput = atoi(vbuff);
                     else if (strcmp(tbuff, "Extensive_star_properties_output")==0)
@@ -1151,6 +1172,10 @@ void GetParamFile(Options &opt)
                         opt.iopenmpfof = atoi(vbuff);
                     else if (strcmp(tbuff, "OMP_fof_region_size")==0)
                         opt.openmpfofsize = atoi(vbuff);
+                    else if (strcmp(tbuff, "FOF_engine")==0)
+                        opt.fofengine = atoi(vbuff);
+                    else if (strcmp(tbuff, "FOF_subsearch_engine")==0)
+                        opt.fofsubengine = atoi(vbuff);
                     else if (strcmp(tbuff, "Gas_internal_property_names")==0) {
                         pos=0;
                         dataline=string(vbuff);
@@ -2035,6 +2060,21 @@ void ConfigCheck(Options &opt)
     }
 #endif
 
+    if (opt.fofengine<FOFENGINETREE || opt.fofengine>FOFENGINEGRID) {
+        ConfigExit("Invalid FOF engine, must be 0 (kd-tree), 1 (union-find) or 2 (cell-grid). Check config");
+    }
+    if (opt.fofsubengine<FOFSUBENGINETREE || opt.fofsubengine>FOFSUBENGINEUNIONFIND) {
+        ConfigExit("Invalid FOF subsearch engine, must be 0 (kd-tree) or 1 (union-find). Check config");
+    }
+    if (opt.ellhalo3dmultixfac.size()>0) {
+#ifdef USEMPI
+        ConfigExit("Multiple 3D linking lengths are not yet supported with MPI. Check config");
+#endif
+        for (auto &x:opt.ellhalo3dmultixfac) if (x<=0) ConfigExit("Invalid multiple 3D linking lengths, must be > 0. Check config");
+        sort(opt.ellhalo3dmultixfac.begin(), opt.ellhalo3dmultixfac.end(), greater<Double_t>());
+        opt.ellhalo3dmultixfac.erase(unique(opt.ellhalo3dmultixfac.begin(), opt.ellhalo3dmultixfac.end()), opt.ellhalo3dmultixfac.end());
+    }
+
 #ifdef USEOPENMP
     if (opt.iopenmpfof == 1 && opt.openmpfofsize < ompfofsearchnum){
         LOG_RANK0(warning) << "OpenMP FOF search region is small, resetting to minimum of " << ompfofsearchnum;
@@ -2355,6 +2395,8 @@ ConfigInfo::ConfigInfo(Options &opt){
     AddEntry("Particle_search_type", opt.partsearchtype);
     AddEntry("FoF_search_type", opt.foftype);
     AddEntry("FoF_Field_search_type", opt.fofbgtype);
+    AddEntry("FOF_engine", opt.fofengine);
+    AddEntry("FOF_subsearch_engine", opt.fofsubengine);
     AddEntry("Search_for_substructure", opt.iSubSearch);
     AddEntry("Keep_FOF", opt.iKeepFOF);
     AddEntry("Iterative_searchflag", opt.iiterflag);
@@ -2387,6 +2429,7 @@ ConfigInfo::ConfigInfo(Options &opt){
     ///\todo this configuration option will be deprecated. Replaced by Halo_3D_physical_linking_length
     //AddEntry("Halo_linking_length_factor", opt.ellhalophysfac);
     AddEntry("Halo_3D_linking_length", opt.ellhalo3dxfac);
+    AddEntry("Halo_3D_multi_linking_lengths", opt.ellhalo3dmultixfac);
     AddEntry("Halo_velocity_linking_length_factor", opt.ellhalovelfac);
 
     //specific to 6DFOF field search
@@ -2480,6 +2523,11 @@ ConfigInfo::ConfigInfo(Options &opt){
     //property related
     AddEntry("Inclusive_halo_masses", opt.iInclusiveHalo);
     AddEntry("Extensive_halo_properties_output", opt.iextrahalooutput);
+    AddEntry("Property_kernels", opt.ipropertykernels);
+    AddEntry("Aperture_min_size", opt.apertureminsize);
+    AddEntry("RVmax_properties_min_size", opt.rvmaxminsize);
+    AddEntry("Morphology_min_size", opt.morphologyminsize);
+    AddEntry("Extra_properties_min_size", opt.extrapropminsize);
     AddEntry("Extensive_gas_properties_output", opt.iextragasoutput);
     AddEntry("Extensive_star_properties_output", opt.iextrastaroutput);
     AddEntry("Extensive_interloper_properties_output", opt.iextrainterloperoutput);